@@ -4,21 +4,170 @@
 #include <iostream>
 #include <utility>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
 #include <sstream>
 #include <functional>
 #include <fstream>
-#include <regex>
 #include <filesystem>
 #include <optional>
 #include <omp.h>
 #include <algorithm>
 #include <iterator>
 #include <type_traits>
+#include <limits>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <charconv>
+#include <cmath>
+#include <tuple>
+#if defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__))
+#define DATABASE_X86_SCAN
+#include <immintrin.h>
+#endif
+
+// up to five bytes to look for, repeating one to look for fewer
+struct byte_set
+{
+    char bytes[5];
+};
+
+// returns the index of the first byte of data[from, size) in set, or size
+using byte_scanner = size_t (*)(const char *data, size_t from, size_t size, const byte_set &set);
+
+inline size_t scan_bytes_scalar(const char *data, size_t from, size_t size, const byte_set &set)
+{
+    for (size_t i = from; i < size; i++)
+    {
+        char c = data[i];
+        if (c == set.bytes[0] || c == set.bytes[1] || c == set.bytes[2] || c == set.bytes[3] || c == set.bytes[4])
+            return i;
+    }
+    return std::max(from, size);
+}
+
+#ifdef DATABASE_X86_SCAN
+// compares 16 bytes at a time against each byte of the set, finishing the tail with the scalar loop
+inline size_t scan_bytes_sse2(const char *data, size_t from, size_t size, const byte_set &set)
+{
+    if (from < size && size - from >= 16)
+    {
+        const __m128i b0 = _mm_set1_epi8(set.bytes[0]), b1 = _mm_set1_epi8(set.bytes[1]), b2 = _mm_set1_epi8(set.bytes[2]),
+                      b3 = _mm_set1_epi8(set.bytes[3]), b4 = _mm_set1_epi8(set.bytes[4]);
+        for (; from + 16 <= size; from += 16)
+        {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + from));
+            __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, b0), _mm_cmpeq_epi8(chunk, b1)),
+                                        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, b2), _mm_cmpeq_epi8(chunk, b3)), _mm_cmpeq_epi8(chunk, b4)));
+            unsigned mask = _mm_movemask_epi8(hits);
+            if (mask != 0)
+                return from + __builtin_ctz(mask);
+        }
+    }
+    return scan_bytes_scalar(data, from, size, set);
+}
+
+// as scan_bytes_sse2, 32 bytes at a time
+__attribute__((target("avx2"))) inline size_t scan_bytes_avx2(const char *data, size_t from, size_t size, const byte_set &set)
+{
+    if (from < size && size - from >= 32)
+    {
+        const __m256i b0 = _mm256_set1_epi8(set.bytes[0]), b1 = _mm256_set1_epi8(set.bytes[1]), b2 = _mm256_set1_epi8(set.bytes[2]),
+                      b3 = _mm256_set1_epi8(set.bytes[3]), b4 = _mm256_set1_epi8(set.bytes[4]);
+        for (; from + 32 <= size; from += 32)
+        {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + from));
+            __m256i hits = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, b0), _mm256_cmpeq_epi8(chunk, b1)),
+                                           _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, b2), _mm256_cmpeq_epi8(chunk, b3)), _mm256_cmpeq_epi8(chunk, b4)));
+            unsigned mask = _mm256_movemask_epi8(hits);
+            if (mask != 0)
+                return from + __builtin_ctz(mask);
+        }
+    }
+    return scan_bytes_sse2(data, from, size, set);
+}
+#endif
+
+enum class scan_kernel
+{
+    scalar,
+    sse2,
+    avx2
+};
+
+inline bool scan_kernel_supported(scan_kernel kernel)
+{
+    switch (kernel)
+    {
+    case scan_kernel::scalar:
+        return true;
+#ifdef DATABASE_X86_SCAN
+    case scan_kernel::sse2:
+        return true;
+    case scan_kernel::avx2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+inline byte_scanner scanner_for(scan_kernel kernel)
+{
+    if (!scan_kernel_supported(kernel))
+        throw std::runtime_error("scan kernel not supported by this cpu");
+    switch (kernel)
+    {
+#ifdef DATABASE_X86_SCAN
+    case scan_kernel::sse2:
+        return scan_bytes_sse2;
+    case scan_kernel::avx2:
+        return scan_bytes_avx2;
+#endif
+    default:
+        return scan_bytes_scalar;
+    }
+}
+
+// the widest kernel the cpu runs, picked once at startup
+inline scan_kernel best_scan_kernel()
+{
+    return scan_kernel_supported(scan_kernel::avx2) ? scan_kernel::avx2
+           : scan_kernel_supported(scan_kernel::sse2) ? scan_kernel::sse2
+                                                      : scan_kernel::scalar;
+}
+
+inline std::atomic<byte_scanner> active_byte_scanner{scanner_for(best_scan_kernel())};
+
+// switches the kernel used by match_quote, match_bracket and the whitespace functions, as for benchmarks;
+// throws if the cpu doesn't support it
+inline void use_scan_kernel(scan_kernel kernel)
+{
+    active_byte_scanner.store(scanner_for(kernel), std::memory_order_relaxed);
+}
+
+inline size_t scan_bytes(std::string_view line, size_t from, const byte_set &set)
+{
+    return active_byte_scanner.load(std::memory_order_relaxed)(line.data(), from, line.size(), set);
+}
 
 
-inline size_t match_quote(const std::string &line, size_t quote_index)
+inline size_t match_quote(std::string_view line, size_t quote_index)
 {
-    if (quote_index > line.size() - 1)
+    if (quote_index >= line.size())
         return std::string::npos;
     if (line[quote_index] != '"')
         return std::string::npos;
@@ -27,6 +176,11 @@ inline size_t match_quote(const std::string &line, size_t quote_index)
     char c;
     while (true)
     {
+        quote_index = scan_bytes(line, quote_index, {{'"', '\\', 0, 0, 0}});
+        if (quote_index >= line.size())
+        {
+            return std::string::npos;
+        }
         c = line[quote_index];
         if (c == 0)
         {
@@ -37,19 +191,15 @@ inline size_t match_quote(const std::string &line, size_t quote_index)
             quote_index += 2;
             continue;
         }
-        if (c == '"')
-        {
-            break;
-        }
-        quote_index++;
+        break;
     }
 
     return quote_index;
 }
 
-inline size_t match_bracket(const std::string &line, size_t bracket_index)
+inline size_t match_bracket(std::string_view line, size_t bracket_index)
 {
-    if (bracket_index > line.size() - 1)
+    if (bracket_index >= line.size())
         return std::string::npos;
     char open = line[bracket_index];
     char close;
@@ -73,6 +223,11 @@ inline size_t match_bracket(const std::string &line, size_t bracket_index)
     size_t depth = 1;
     while (true)
     {
+        bracket_index = scan_bytes(line, bracket_index, {{open, close, '"', 0, 0}});
+        if (bracket_index >= line.size())
+        {
+            return std::string::npos;
+        }
         c = line[bracket_index];
         if (c == 0)
         {
@@ -109,19 +264,49 @@ inline std::string de_whitespace_json(const std::string &line)
     size_t back;
     for (size_t i = 0; i < line.size(); i++)
     {
+        // copy up to the next string or whitespace in one go
+        size_t next = scan_bytes(line, i, {{'"', ' ', '\t', '\r', '\n'}});
+        ret.append(line, i, next - i);
+        if (next == line.size())
+            break;
+        i = next;
         if (line[i] == '"')
         {
             back = match_quote(line, i);
-            while (i < back)
-                ret.push_back(line[i++]);
+            if (back == std::string::npos)
+            {
+                // an unterminated string runs to the end, for verify_json to reject
+                ret.append(line, i);
+                break;
+            }
+            ret.append(line, i, back - i + 1);
+            i = back;
         }
-        if (line[i] != ' ' && line[i] != '\t' && line[i] != '\r' && line[i] != '\n')
-            ret.push_back(line[i]);
     }
 
     return ret;
 }
 
+// true if de_whitespace_json would leave json unchanged
+inline bool json_is_minified(std::string_view json)
+{
+    for (size_t i = 0; i < json.size(); i++)
+    {
+        i = scan_bytes(json, i, {{'"', ' ', '\t', '\r', '\n'}});
+        if (i >= json.size())
+            break;
+        if (json[i] == '"')
+        {
+            i = match_quote(json, i);
+            if (i == std::string::npos)
+                break;
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
 // this function assumes well-formatted json, which will be checked at input by a later defined function
 inline std::vector<std::string> tokenize_json(const std::string &json)
 {
@@ -445,2010 +630,5303 @@ if (status) return std::string("json verification failed: " + *status);
 return std::nullopt;
 }
 
-inline bool json_is_null(const std::string &data, const std::string &field)
-{
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
-    {
-        if (fields[i] == field)
-        {
-            if (fields[i + 1] == "null")
-            {
-                return true;
-            }
-
-            return false;
-        }
-    }
-    throw std::runtime_error("Field does not exist");
-}
-
-class json_array
+// walks json once, checking it against the strict grammar below and copying it without whitespace. Anything the
+// grammar accepts, verify_json accepts too, so only rejected input needs the slower functions to name the error
+class json_minifier
 {
 public:
-json_array()
-{
-    data = "";
-}
-
-json_array(const std::string &data)
-{
-    this->data = data;
-    }
-
-    template <typename T>
-    T get(size_t field) const
+    // out may be null to only check the input
+    json_minifier(std::string_view in, std::string *out) : in(in), out(out)
     {
-        throw std::runtime_error("Type provided is not a legal type for json data");
     }
 
-    bool is_null(size_t field)
+    // true if the input is a single object, with whitespace only between tokens
+    bool run()
     {
-        auto fields = tokenize_array(data);
-        if (field >= fields.size())
-        {
-            throw std::runtime_error("Index out of bounds");
-        }
-
-        if (fields[field] == "null")
+        if (out)
         {
-            return true;
+            out->clear();
+            out->reserve(in.size());
         }
-        return false;
+        return object() && (skip_whitespace(), pos == in.size());
     }
 
 private:
-    std::string data;
-    friend class Document;
-    std::string get_as_string(size_t field)
-    {
-        auto fields = tokenize_array(data);
-        if (field >= fields.size())
-            throw std::runtime_error("Index out of bounds");
-
-        return fields[field];
-    }
-};
+    std::string_view in;
+    std::string *out;
+    size_t pos = 0;
 
-class json_object
-{
-public:
-    json_object()
+    void skip_whitespace()
     {
-        data = "";
+        while (pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' || in[pos] == '\r' || in[pos] == '\n'))
+            pos++;
     }
 
-    json_object(const std::string &data)
+    // copies in[pos...end) and moves past it
+    void copy_to(size_t end)
     {
-        this->data = data;
+        if (out)
+            out->append(in.data() + pos, end - pos);
+        pos = end;
     }
 
-    template <typename T>
-    T get(const std::string &field) const
+    bool consume(char c)
     {
-        throw std::runtime_error("Type provided is not a legal type for json data");
+        skip_whitespace();
+        if (pos >= in.size() || in[pos] != c)
+            return false;
+        copy_to(pos + 1);
+        return true;
     }
 
-    bool is_null(const std::string &field)
+    bool value()
     {
-        return json_is_null(data, field);
+        skip_whitespace();
+        if (pos >= in.size())
+            return false;
+        switch (in[pos])
+        {
+        case '{':
+            return object();
+        case '[':
+            return array();
+        case '"':
+            return string();
+        case 't':
+            return literal("true");
+        case 'f':
+            return literal("false");
+        case 'n':
+            return literal("null");
+        case 'd':
+            return literal("delete");
+        default:
+            return number();
+        }
     }
 
-private:
-    std::string data;
-    friend class Document;
-    std::string get_as_string(const std::string& field)
+    bool object()
     {
-        auto fields = tokenize_json(data);
-        for (size_t i = 0; i < fields.size(); i += 2)
+        if (!consume('{'))
+            return false;
+        if (consume('}'))
+            return true;
+        do
         {
-            if (fields[i] == field)
-            {
-                return fields[i + 1];
-            }
-        }
-        throw std::runtime_error("Field does not exist");
+            skip_whitespace();
+            if (!string() || !consume(':') || !value())
+                return false;
+        } while (consume(','));
+        return consume('}');
     }
-};
 
-template <>
-inline std::string json_array::get<std::string>(size_t field) const
-{
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
+    bool array()
     {
-        throw std::runtime_error("Index out of bounds");
+        if (!consume('['))
+            return false;
+        if (consume(']'))
+            return true;
+        do
+        {
+            if (!value())
+                return false;
+        } while (consume(','));
+        return consume(']');
     }
 
-    if (fields[field][0] != '"')
+    bool string()
     {
-        throw std::runtime_error("Field is not a string");
+        size_t end = match_quote(in, pos);
+        if (end == std::string::npos)
+            return false;
+        copy_to(end + 1);
+        return true;
     }
 
-    return fields[field];
-}
-
-template <>
-inline int json_array::get<int>(size_t field) const
-{
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
+    bool literal(std::string_view word)
     {
-        throw std::runtime_error("Index out of bounds");
+        if (in.compare(pos, word.size(), word) != 0)
+            return false;
+        copy_to(pos + word.size());
+        return true;
     }
 
-    if (fields[field][0] == '"' || fields[field][0] == '[' || fields[field][0] == '{' || fields[field] == "null" || fields[field] == "true" || fields[field] == "false")
+    // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+    bool number()
     {
-        throw std::runtime_error("Field is not a number");
+        size_t end = pos;
+        auto digits = [&]()
+        {
+            size_t first = end;
+            while (end < in.size() && in[end] >= '0' && in[end] <= '9')
+                end++;
+            return end > first;
+        };
+
+        if (end < in.size() && in[end] == '-')
+            end++;
+        if (end < in.size() && in[end] == '0')
+            end++;
+        else if (!digits())
+            return false;
+        if (end < in.size() && in[end] == '.')
+        {
+            end++;
+            if (!digits())
+                return false;
+        }
+        if (end < in.size() && (in[end] == 'e' || in[end] == 'E'))
+        {
+            end++;
+            if (end < in.size() && (in[end] == '+' || in[end] == '-'))
+                end++;
+            if (!digits())
+                return false;
+        }
+        copy_to(end);
+        return true;
     }
+};
 
-    return std::stod(fields[field]);
+// minifies json into out and verifies it, walking the input once; the result and out are the same as from
+// de_whitespace_json followed by verify_json, which only run to describe the error in rejected input
+inline std::optional<std::string> minify_json(std::string_view json, std::string &out)
+{
+    if (json_minifier(json, &out).run())
+        return std::nullopt;
+    out = de_whitespace_json(std::string(json));
+    return verify_json(out);
 }
 
-template <>
-inline double json_array::get<double>(size_t field) const
+// verify_json for json that is already minified, without copying it
+inline std::optional<std::string> verify_minified_json(std::string_view json)
 {
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
-    {
-        throw std::runtime_error("Index out of bounds");
-    }
+    if (json_minifier(json, nullptr).run())
+        return std::nullopt;
+    return verify_json(std::string(json));
+}
 
-    if (fields[field][0] == '"' || fields[field][0] == '[' || fields[field][0] == '{' || fields[field] == "null" || fields[field] == "true" || fields[field] == "false")
+// returns the index one past the end of the value starting at front
+// assumes de_whitespaced json like tokenize_json
+inline size_t json_value_end(std::string_view json, size_t front)
+{
+    size_t back;
+    switch (json[front])
     {
-        throw std::runtime_error("Field is not a number");
+    case '"':
+        back = match_quote(json, front);
+        break;
+    case '[':
+    case '{':
+        back = match_bracket(json, front);
+        break;
+    default:
+        back = front + 1;
+        while (back < json.size() && json[back] != ',' && json[back] != '}' && json[back] != ']')
+            back++;
+        return back;
     }
-
-    return std::stod(fields[field]);
+    if (back == std::string::npos)
+        return json.size();
+    return back + 1;
 }
 
-template <>
-inline bool json_array::get<bool>(size_t field) const
+// non-allocating lookup of a field's value in a de_whitespaced object
+inline std::optional<std::string_view> json_find_field(std::string_view object, std::string_view field)
 {
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
+    if (object.size() < 3 || object.front() != '{')
     {
-        throw std::runtime_error("Index out of bounds");
+        return std::nullopt;
     }
 
-    if (fields[field] != "true" && fields[field] != "false")
+    size_t front = 0;
+    size_t back = 0;
+    while (back < object.size() - 1)
     {
-        throw std::runtime_error("Field is not a bool");
-    }
+        front = back + 1;
+        back = match_quote(object, front);
+        if (back == std::string::npos)
+            return std::nullopt;
+        std::string_view key = object.substr(front + 1, back - front - 1);
 
-    return (fields[field] == "true");
+        front = back + 2;
+        if (front >= object.size())
+            return std::nullopt;
+        back = json_value_end(object, front);
+        if (key == field)
+        {
+            return object.substr(front, back - front);
+        }
+    }
+    return std::nullopt;
 }
 
-template <>
-inline json_object json_array::get<json_object>(size_t field) const
+// non-allocating lookup of an element in a de_whitespaced array
+inline std::optional<std::string_view> json_find_index(std::string_view array, size_t index)
 {
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
+    if (array.size() < 3 || array.front() != '[')
     {
-        throw std::runtime_error("Index out of bounds");
+        return std::nullopt;
     }
 
-    if (fields[field][0] != '{')
+    size_t front = 0;
+    size_t back = 0;
+    while (back < array.size() - 1)
     {
-        throw std::runtime_error("Field is not an object");
+        front = back + 1;
+        back = json_value_end(array, front);
+        if (index-- == 0)
+        {
+            return array.substr(front, back - front);
+        }
     }
-
-    return json_object(fields[field]);
+    return std::nullopt;
 }
 
-template <>
-inline json_array json_array::get<json_array>(size_t field) const
+// One entry of a parsed document. A document's tape is a preorder walk of its values, where
+// object members are stored as a key node (type ':', span inside the quotes) followed by the value.
+// Offsets are into the de_whitespaced json the tape was built from.
+struct json_node
 {
-    auto fields = tokenize_array(data);
-    if (field >= fields.size())
-    {
-        throw std::runtime_error("Index out of bounds");
-    }
-
-    if (fields[field][0] != '[')
-    {
-        throw std::runtime_error("Field is not an array");
-    }
+    char type;     // first character of the value, or ':' for a key
+    uint32_t begin; // index of the first character
+    uint32_t end;   // index one past the last character
+    uint32_t next;  // tape index after this node and all of its children
+};
 
-    return json_array(fields[field]);
-}
+inline constexpr size_t no_node = std::numeric_limits<size_t>::max();
 
-inline json_object json_extract_object(const std::string &data, const std::string &field)
+// must be passed verified, de_whitespaced json
+inline std::vector<json_node> build_json_tape(std::string_view json)
 {
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
+    std::vector<json_node> tape;
+    if (json.empty())
+        return tape;
+    tape.reserve(json.size() / 8 + 1);
+
+    std::function<size_t(size_t)> parse_value = [&](size_t front) -> size_t
     {
-        if (fields[i] == field)
+        size_t node = tape.size();
+        tape.push_back({json[front], (uint32_t)front, 0, 0});
+
+        size_t back;
+        if (json[front] == '{' || json[front] == '[')
         {
-            if (fields[i + 1][0] != '{')
+            bool is_object = json[front] == '{';
+            back = front + 1;
+            while (back < json.size() && json[back] != '}' && json[back] != ']')
             {
-                throw std::runtime_error("Field is not an object");
+                if (is_object)
+                {
+                    size_t close = match_quote(json, back);
+                    tape.push_back({':', (uint32_t)(back + 1), (uint32_t)close, (uint32_t)(tape.size() + 1)});
+                    back = close + 2;
+                }
+                back = parse_value(back);
+                if (json[back] == ',')
+                    back++;
             }
-
-            return json_object(fields[i + 1]);
+            back++;
         }
-    }
-    throw std::runtime_error("Field does not exist");
+        else
+        {
+            back = json_value_end(json, front);
+        }
+
+        tape[node].end = back;
+        tape[node].next = tape.size();
+        return back;
+    };
+
+    parse_value(0);
+    return tape;
 }
 
-inline json_array json_extract_array(const std::string &data, const std::string &field)
+// whether tape could have been built from json, as far as walking it goes: every span lies within json and starts
+// with its node's type, object members are key nodes followed by a value, and each next stays inside its parent.
+// Lets a tape read back from disk be used without trusting it to keep lookups inside json
+inline bool json_tape_fits(const std::vector<json_node> &tape, std::string_view json)
 {
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
+    std::function<bool(size_t, size_t)> fits = [&](size_t node, size_t limit) -> bool
     {
-        if (fields[i] == field)
+        const json_node &n = tape[node];
+        if (n.next <= node || n.next > limit || n.begin >= n.end || n.end > json.size() || json[n.begin] != n.type)
+            return false;
+        if (n.type == '{')
         {
-            if (fields[i + 1][0] != '[')
+            for (size_t i = node + 1; i < n.next; i = tape[i + 1].next)
             {
-                throw std::runtime_error("Field is not an array");
+                const json_node &key = tape[i];
+                if (key.type != ':' || key.next != i + 1 || i + 1 >= n.next || key.begin > key.end ||
+                    key.end > json.size() || !fits(i + 1, n.next))
+                    return false;
             }
-
-            return json_array(fields[i + 1]);
         }
-    }
-    throw std::runtime_error("Field does not exist");
-}
-
-inline std::string json_extract_string(const std::string &data, const std::string &field)
-{
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
-    {
-        if (fields[i] == field)
+        else if (n.type == '[')
         {
-            if (fields[i + 1][0] != '"')
+            for (size_t i = node + 1; i < n.next; i = tape[i].next)
             {
-                throw std::runtime_error("Field is not a string");
+                if (!fits(i, n.next))
+                    return false;
             }
-
-            return fields[i + 1];
         }
-    }
-    throw std::runtime_error("Field does not exist");
+        else if (n.next != node + 1)
+        {
+            return false;
+        }
+        return true;
+    };
+
+    if (tape.empty())
+        return true;
+    return tape[0].begin == 0 && tape[0].end == json.size() && tape[0].next == tape.size() && fits(0, tape.size());
 }
 
-inline int json_extract_int(const std::string &data, const std::string &field)
+// returns the tape index of the value of field in the object at node, or no_node
+inline size_t tape_find_field(const char *text, const json_node *tape, size_t node, std::string_view field)
 {
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
+    for (size_t i = node + 1; i < tape[node].next; i = tape[i + 1].next)
     {
-        if (fields[i] == field)
+        if (std::string_view(text + tape[i].begin, tape[i].end - tape[i].begin) == field)
         {
-            if (fields[i + 1][0] == '"' || fields[i + 1][0] == '[' || fields[i + 1][0] == '{' || fields[i + 1] == "null" || fields[i + 1] == "true" || fields[i + 1] == "false")
-            {
-                throw std::runtime_error("Field is not a number");
-            }
-
-            return std::stod(fields[i + 1]);
+            return i + 1;
         }
     }
-    throw std::runtime_error("Field does not exist");
+    return no_node;
 }
 
-inline double json_extract_double(const std::string &data, const std::string &field)
+// returns the tape index of the index-th element of the array at node, or no_node
+inline size_t tape_find_index(const json_node *tape, size_t node, size_t index)
 {
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
+    for (size_t i = node + 1; i < tape[node].next; i = tape[i].next)
     {
-        if (fields[i] == field)
+        if (index-- == 0)
         {
-            if (fields[i + 1][0] == '"' || fields[i + 1][0] == '[' || fields[i + 1][0] == '{' || fields[i + 1] == "null" || fields[i + 1] == "true" || fields[i + 1] == "false")
-            {
-                throw std::runtime_error("Field is not a number");
-            }
-
-            return std::stod(fields[i + 1]);
+            return i;
         }
     }
-    throw std::runtime_error("Field does not exist");
+    return no_node;
 }
 
-inline bool json_extract_bool(const std::string &data, const std::string &field)
+inline std::string_view tape_value(const char *text, const json_node &node)
 {
-    auto fields = tokenize_json(data);
-    for (size_t i = 0; i < fields.size(); i += 2)
-    {
-        if (fields[i] == field)
-        {
-            if (fields[i + 1] != "true" && fields[i + 1] != "false")
-            {
-                throw std::runtime_error("Field is not a bool");
-            }
-
-            return (fields[i + 1] == "true");
-        }
-    }
-    throw std::runtime_error("Field does not exist");
+    return std::string_view(text + node.begin, node.end - node.begin);
 }
 
-template <>
-inline std::string json_object::get<std::string>(const std::string &field) const
+inline bool json_is_number(std::string_view value)
 {
-    return json_extract_string(data, field);
+    return !(value[0] == '"' || value[0] == '[' || value[0] == '{' || value == "null" || value == "true" || value == "false");
 }
 
-template <>
-inline int json_object::get<int>(const std::string &field) const
+inline bool json_is_null(const std::string &data, const std::string &field)
 {
-    return json_extract_int(data, field);
+    auto value = json_find_field(data, field);
+    if (!value)
+    {
+        throw std::runtime_error("Field does not exist");
+    }
+    return *value == "null";
 }
 
-template <>
-inline double json_object::get<double>(const std::string &field) const
+// a value located in a json string, along with its tape position when the source is parsed
+struct json_ref
 {
-    return json_extract_double(data, field);
-}
+    std::string_view value;
+    const char *text = nullptr;
+    const json_node *tape = nullptr;
+    size_t node = 0;
+};
 
-template <>
-inline bool json_object::get<bool>(const std::string &field) const
+template <typename T>
+T json_value_as(const json_ref &ref)
 {
-    return json_extract_bool(data, field);
+    throw std::runtime_error("Type provided is not a legal type for json data");
 }
 
-template <>
-inline json_object json_object::get<json_object>(const std::string &field) const
+// as json_value_as, but objects and arrays own a copy of their json instead of viewing into ref's source
+template <typename T>
+T json_value_owned(const json_ref &ref);
+
+// the value of field in the object ref refers to; throws if it doesn't exist
+inline json_ref json_ref_field(const json_ref &ref, std::string_view field)
 {
-    return json_extract_object(data, field);
+    if (ref.tape)
+    {
+        size_t found = tape_find_field(ref.text, ref.tape, ref.node, field);
+        if (found == no_node)
+            throw std::runtime_error("Field does not exist");
+        return {tape_value(ref.text, ref.tape[found]), ref.text, ref.tape, found};
+    }
+
+    auto value = json_find_field(ref.value, field);
+    if (!value)
+        throw std::runtime_error("Field does not exist");
+    return {*value};
 }
 
-template <>
-inline json_array json_object::get<json_array>(const std::string &field) const
+// the element at index in the array ref refers to; throws if it is out of bounds
+inline json_ref json_ref_index(const json_ref &ref, size_t index)
 {
-    return json_extract_array(data, field);
+    if (ref.tape)
+    {
+        size_t found = tape_find_index(ref.tape, ref.node, index);
+        if (found == no_node)
+            throw std::runtime_error("Index out of bounds");
+        return {tape_value(ref.text, ref.tape[found]), ref.text, ref.tape, found};
+    }
+
+    auto value = json_find_index(ref.value, index);
+    if (!value)
+        throw std::runtime_error("Index out of bounds");
+    return {*value};
 }
 
-class Document
+class json_array
 {
 public:
-    Document()
+    json_array()
     {
-        id = next_id++;
     }
-    Document(const std::string &json)
+
+    // owns a copy of data; wrappers returned by get are views instead
+    json_array(const std::string &data)
     {
-        data = de_whitespace_json(json);
-        auto failure = verify_json(data);
-        if (failure) throw std::runtime_error(*failure);
-        id = next_id++;
+        this->data = data;
     }
-    Document(size_t id, const std::string &json)
+
+    template <typename T>
+    T get(size_t field) const &
     {
-        data = de_whitespace_json(json);
-        auto failure = verify_json(data);
-        if (failure) throw std::runtime_error(*failure);
-        this->id = id;
+        return json_value_as<T>(find_index(field));
     }
 
+    // a temporary that owns its json can't be viewed into past the statement, so it hands out copies
     template <typename T>
-    T get(const std::string &field) const
+    T get(size_t field) const &&
     {
-        throw std::runtime_error("Type provided is not a legal type for json data");
+        if (value.data())
+            return json_value_as<T>(find_index(field));
+        return json_value_owned<T>(find_index(field));
     }
 
-    template <typename T>
-    T query(const std::string &path) const
+    bool is_null(size_t field)
     {
-        throw std::runtime_error("Type provided is not a legal type for json data");
+        return find_index(field).value == "null";
     }
 
-    bool is_null(const std::string &field)
+private:
+    std::string data; // only for wrappers made by the public constructor
+    // set instead of data when viewing into a document's json, and its tape when it's parsed
+    std::string_view value;
+    const char *text = nullptr;
+    const json_node *tape = nullptr;
+    size_t node = 0;
+
+    explicit json_array(const json_ref &ref) : value(ref.value), text(ref.text), tape(ref.tape), node(ref.node) {}
+
+    friend class Document;
+    template <typename T>
+    friend T json_value_as(const json_ref &ref);
+
+    json_ref root() const
     {
-        return json_is_null(data, field);
+        if (value.data())
+            return {value, text, tape, node};
+        return {data};
     }
 
-    size_t get_id() const
+    json_ref find_index(size_t field) const
     {
-        return id;
+        return json_ref_index(root(), field);
     }
 
-    std::string to_string() const
+    std::string get_as_string(size_t field)
     {
-        std::stringstream ss;
+        return std::string(find_index(field).value);
+    }
+};
 
-        auto print_tabs = [&ss](size_t n)
-        {
-            for (size_t i = 0; i < n; i++)
-            {
-                ss << '\t';
-            }
-        };
+class json_object
+{
+public:
+    json_object()
+    {
+    }
 
-        std::function<void(const std::string &, size_t)> stream_formatted_object;
+    // owns a copy of data; wrappers returned by get are views instead
+    json_object(const std::string &data)
+    {
+        this->data = data;
+    }
 
-        std::function<void(const std::string &, size_t)> stream_formatted_array = [&](const std::string &data, size_t depth)
-        {
-            ss << '[';
-            auto tokens = tokenize_array(data);
-            if (tokens.size() == 0)
-            {
-                ss << ']';
-                return;
-            }
-            for (const auto &t : tokens)
-            {
-                ss << '\n';
-                print_tabs(depth + 1);
-                switch (t[0])
-                {
-                case '[':
-                    stream_formatted_array(t, depth + 1);
-                    break;
-                case '{':
-                    stream_formatted_object(t, depth + 1);
-                    break;
-                default:
-                    ss << t;
-                }
-                ss << ',';
-            }
-            ss.seekp(-1, ss.cur);
-            ss << '\n';
-            print_tabs(depth);
-            ss << ']';
-        };
+    template <typename T>
+    T get(const std::string &field) const &
+    {
+        return json_value_as<T>(find_field(field));
+    }
 
-        stream_formatted_object = [&](const std::string &data, size_t depth)
-        {
-            ss << '{';
-            auto tokens = tokenize_json(data);
-            if (tokens.size() == 0)
-            {
-                ss << '}';
-                return;
-            }
-            for (size_t i = 0; i < tokens.size(); i += 2)
-            {
-                ss << '\n';
-                print_tabs(depth + 1);
-                ss << tokens[i] << ": ";
-                switch (tokens[i + 1][0])
-                {
-                case '[':
-                    stream_formatted_array(tokens[i + 1], depth + 1);
-                    break;
-                case '{':
-                    stream_formatted_object(tokens[i + 1], depth + 1);
-                    break;
-                default:
-                    ss << tokens[i + 1];
-                }
-                ss << ',';
-            }
-            ss.seekp(-1, ss.cur);
-            ss << '\n';
-            print_tabs(depth);
-            ss << '}';
-        };
+    // a temporary that owns its json can't be viewed into past the statement, so it hands out copies
+    template <typename T>
+    T get(const std::string &field) const &&
+    {
+        if (value.data())
+            return json_value_as<T>(find_field(field));
+        return json_value_owned<T>(find_field(field));
+    }
 
-        ss << "Document " << id << ": ";
-        stream_formatted_object(data, 0);
-        return ss.str();
+    bool is_null(const std::string &field)
+    {
+        return find_field(field).value == "null";
     }
 
 private:
-    size_t id; // index in Collection, but when in a smaller subset will need access
-    static size_t next_id;
-    std::string data; // as json
-
-    std::string query_as_string(const std::string &path) const;
-
-    friend class Collection;
-    friend class uCollection;
-};
+    std::string data; // only for wrappers made by the public constructor
+    // set instead of data when viewing into a document's json, and its tape when it's parsed
+    std::string_view value;
+    const char *text = nullptr;
+    const json_node *tape = nullptr;
+    size_t node = 0;
 
-inline std::pair<std::vector<std::string>, std::vector<std::string>> tokenize_pattern(std::string pattern)
-{
-    // "field1"."field2"[2].data1
+    explicit json_object(const json_ref &ref) : value(ref.value), text(ref.text), tape(ref.tape), node(ref.node) {}
 
-    pattern = de_whitespace_json(pattern);
+    friend class Document;
+    template <typename T>
+    friend T json_value_as(const json_ref &ref);
 
-    if (pattern.size() == 0)
+    json_ref root() const
     {
-        throw std::runtime_error("no pattern");
+        if (value.data())
+            return {value, text, tape, node};
+        return {data};
     }
 
-    //"field 1" = true & "field 2" = 3
-    size_t front = 0;
-    size_t back = 0;
-
-    // parse pattern
-    std::vector<std::string> keys;
-    std::vector<std::string> vals;
-
-    // split at '&'
-    while (back != pattern.size())
+    json_ref find_field(std::string_view field) const
     {
-        switch (pattern[back])
-        {
-        case '"':
-            back = match_quote(pattern, back);
-            break;
-        case '{':
-        case '[':
-            back = match_bracket(pattern, back);
-            break;
-        case '&':
-            keys.push_back(pattern.substr(front, back - front));
-            front = back + 1;
-            break;
-        default:
-            break;
-        }
-        back++;
+        return json_ref_field(root(), field);
     }
-    keys.push_back(pattern.substr(front));
-    for (size_t i = 0; i < keys.size(); i++)
+
+    std::string get_as_string(const std::string &field)
     {
-        back = 0;
-        while (back < keys.at(i).size())
-        {
-            if (keys.at(i)[back] == '"')
-            {
-                back = match_quote(keys.at(i), back);
-            }
-            if (keys.at(i)[back] == '=')
-            {
-                break;
-            }
-            back++;
-        }
-        if (back == keys.size())
-        {
-            throw std::runtime_error("syntax issue: missing equal sign");
-        }
-        if (back == 0)
-        {
-            throw std::runtime_error("syntax issue: no key");
-        }
-        vals.push_back(keys.at(i).substr(back + 1));
-        keys.at(i) = keys.at(i).substr(0, back);
+        return std::string(find_field(field).value);
     }
-    return std::make_pair(keys, vals);
-}
+};
 
-inline std::pair<std::string, std::string> get_first_field(std::string query)
+template <>
+inline std::string json_value_as<std::string>(const json_ref &ref)
 {
-    std::regex regex{R"(((".+?")|(\[[0-9]+?\])))"};
-
-    std::smatch match;
-
-    std::regex_search(query, match, regex);
-    if (match.suffix().str() != "")
+    if (ref.value[0] != '"')
     {
-        if (match.suffix().str()[0] == '.')
-        {
-            return {match.str(1), match.suffix().str().substr(1)};
-        }
+        throw std::runtime_error("Field is not a string");
     }
 
-    return {match.str(1), match.suffix().str()};
+    return std::string(ref.value);
 }
 
 template <>
-inline std::string Document::get<std::string>(const std::string &field) const
+inline int json_value_as<int>(const json_ref &ref)
 {
-    return json_extract_string(data, field);
-}
+    if (!json_is_number(ref.value))
+    {
+        throw std::runtime_error("Field is not a number");
+    }
 
-template <>
-inline int Document::get<int>(const std::string &field) const
-{
-    return json_extract_int(data, field);
+    return std::stod(std::string(ref.value));
 }
 
 template <>
-inline double Document::get<double>(const std::string &field) const
+inline double json_value_as<double>(const json_ref &ref)
 {
-    return json_extract_double(data, field);
+    if (!json_is_number(ref.value))
+    {
+        throw std::runtime_error("Field is not a number");
+    }
+
+    return std::stod(std::string(ref.value));
 }
 
 template <>
-inline bool Document::get<bool>(const std::string &field) const
+inline bool json_value_as<bool>(const json_ref &ref)
 {
-    return json_extract_bool(data, field);
+    if (ref.value != "true" && ref.value != "false")
+    {
+        throw std::runtime_error("Field is not a bool");
+    }
+
+    return (ref.value == "true");
 }
 
 template <>
-inline json_object Document::get<json_object>(const std::string &field) const
+inline json_object json_value_as<json_object>(const json_ref &ref)
 {
-    return json_extract_object(data, field);
+    if (ref.value[0] != '{')
+    {
+        throw std::runtime_error("Field is not an object");
+    }
+
+    return json_object(ref);
 }
 
 template <>
-inline json_array Document::get<json_array>(const std::string &field) const
+inline json_array json_value_as<json_array>(const json_ref &ref)
 {
-    return json_extract_array(data, field);
+    if (ref.value[0] != '[')
+    {
+        throw std::runtime_error("Field is not an array");
+    }
+
+    return json_array(ref);
 }
 
-template <>
-inline std::string Document::query<std::string>(const std::string &field) const
+template <typename T>
+T json_value_owned(const json_ref &ref)
 {
-    json_object o_temp;
-    json_array a_temp;
-
-    // get key and remain
-    auto [key, remain] = get_first_field(field);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+    if constexpr (std::is_same_v<T, json_object> || std::is_same_v<T, json_array>)
     {
-        if (remain[0] == '"')
-        {
-            o_temp = this->get<json_object>(key);
-            i = 1;
-        }
-        if (remain[0] == '[')
-        {
-            a_temp = this->get<json_array>(key);
-            i = 2;
-        }
+        json_value_as<T>(ref); // checks the type
+        return T(std::string(ref.value));
     }
+    else
+    {
+        return json_value_as<T>(ref);
+    }
+}
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
+inline json_ref json_extract_field(const std::string &data, const std::string &field)
+{
+    auto value = json_find_field(data, field);
+    if (!value)
     {
-        if (i == 1)
-        {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
+        throw std::runtime_error("Field does not exist");
+    }
+    return {*value};
+}
 
-            if (remain[0] == '[')
-            {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
-            }
-        }
-        else if (i == 2)
-        {
+inline json_object json_extract_object(const std::string &data, const std::string &field)
+{
+    return json_value_as<json_object>(json_extract_field(data, field));
+}
 
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
+inline json_array json_extract_array(const std::string &data, const std::string &field)
+{
+    return json_value_as<json_array>(json_extract_field(data, field));
+}
 
-            if (remain[0] == '[')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
-    }
+inline std::string json_extract_string(const std::string &data, const std::string &field)
+{
+    return json_value_as<std::string>(json_extract_field(data, field));
+}
 
-    if (i == 1)
-    {
-        return o_temp.get<std::string>(key);
-    }
-    return a_temp.get<std::string>(std::stoi(key));
+inline int json_extract_int(const std::string &data, const std::string &field)
+{
+    return json_value_as<int>(json_extract_field(data, field));
 }
 
-template <>
-inline int Document::query<int>(const std::string &path) const
+inline double json_extract_double(const std::string &data, const std::string &field)
+{
+    return json_value_as<double>(json_extract_field(data, field));
+}
+
+inline bool json_extract_bool(const std::string &data, const std::string &field)
+{
+    return json_value_as<bool>(json_extract_field(data, field));
+}
+
+// one step of a path query: an object key or an array index
+struct path_segment
+{
+    bool is_index;
+    std::string key;
+    size_t index;
+};
+
+// a path segment as read by path_lexer; key views into the lexed path
+struct path_token
+{
+    bool is_index;
+    std::string_view key;
+    size_t index;
+};
+
+// Splits a path such as "key"."sub"[3] into keys and indices without allocating.
+// Keys may contain escaped quotes and are returned without their surrounding quotes.
+class path_lexer
 {
-    json_object o_temp;
-    json_array a_temp;
+public:
+    path_lexer(std::string_view path) : path(path) {}
 
-    // get key and remain
-    auto [key, remain] = get_first_field(path);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+    // reads the next segment into token; returns false at the end of the path and throws on bad syntax
+    bool next(path_token &token)
     {
-        if (remain[0] == '"')
-        {
-            o_temp = this->get<json_object>(key);
-            i = 1;
-        }
-        if (remain[0] == '[')
+        if (pos < path.size() && path[pos] == '.' && pos != 0)
+            pos++;
+        if (pos >= path.size())
+            return false;
+
+        if (path[pos] == '"')
         {
-            a_temp = this->get<json_array>(key);
-            i = 2;
+            size_t close = match_quote(path, pos);
+            if (close == std::string::npos)
+                throw std::runtime_error("syntax issue: unterminated key in path");
+            token.is_index = false;
+            token.key = path.substr(pos + 1, close - pos - 1);
+            token.index = 0;
+            pos = close + 1;
+            return true;
         }
-    }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
-    {
-        if (i == 1)
+        if (path[pos] == '[')
         {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
-
-            if (remain[0] == '[')
+            size_t i = pos + 1;
+            size_t index = 0;
+            while (i < path.size() && path[i] >= '0' && path[i] <= '9')
             {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
+                index = index * 10 + (path[i] - '0');
+                i++;
             }
+            if (i == pos + 1 || i >= path.size() || path[i] != ']')
+                throw std::runtime_error("syntax issue: bad index in path");
+            token.is_index = true;
+            token.key = path.substr(pos, i + 1 - pos);
+            token.index = index;
+            pos = i + 1;
+            return true;
         }
-        else if (i == 2)
-        {
-
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
 
-            if (remain[0] == '[')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
+        throw std::runtime_error("syntax issue: expected key or index in path");
     }
 
-    if (i == 1)
+    // the part of the path not yet read, without a leading '.'
+    std::string_view remaining() const
     {
-        return o_temp.get<int>(key);
+        if (pos < path.size() && path[pos] == '.')
+            return path.substr(pos + 1);
+        return path.substr(pos);
     }
-    return a_temp.get<int>(std::stoi(key));
-}
 
-template <>
-inline double Document::query<double>(const std::string &field) const
-{
-    json_object o_temp;
-    json_array a_temp;
+private:
+    std::string_view path;
+    size_t pos = 0;
+};
 
-    // get key and remain
-    auto [key, remain] = get_first_field(field);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+// splits a stream of top level json objects, undelimited or wrapped in an array, as blocks of it arrive
+class document_splitter
+{
+public:
+    // appends every object completed within block to out; a partial one is kept for the next block
+    void feed(std::string_view block, std::vector<std::string> &out)
     {
-        if (remain[0] == '"')
+        size_t start = scan(block, [&](size_t front, size_t back)
         {
-            o_temp = this->get<json_object>(key);
-            i = 1;
-        }
-        if (remain[0] == '[')
-        {
-            a_temp = this->get<json_array>(key);
-            i = 2;
-        }
+            partial.append(block.substr(front, back - front));
+            out.push_back(std::move(partial));
+            partial.clear();
+        });
+
+        if (start != std::string::npos)
+            partial.append(block.substr(start));
     }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
+    // appends a view of every object in a complete buffer to out, without copying
+    void split(std::string_view buffer, std::vector<std::string_view> &out)
     {
-        if (i == 1)
-        {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
-
-            if (remain[0] == '[')
-            {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
-            }
-        }
-        else if (i == 2)
+        scan(buffer, [&](size_t front, size_t back)
         {
-
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
-
-            if (remain[0] == '[')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
+            out.push_back(buffer.substr(front, back - front));
+        });
     }
 
-    if (i == 1)
+    // true if the stream ended in the middle of a document
+    bool incomplete() const
     {
-        return o_temp.get<double>(key);
+        return in_document();
     }
-    return a_temp.get<double>(std::stoi(key));
-}
 
-template <>
-inline bool Document::query<bool>(const std::string &field) const
-{
-    json_object o_temp;
-    json_array a_temp;
+private:
+    std::string partial;
+    size_t depth = 0;
+    size_t base = 0; // depth of the documents themselves, 1 when inside an array
+    bool started = false;
+    bool closed = false; // past the array's closing bracket, so only whitespace may follow
+    bool in_string = false;
+    bool escaped = false;
+
+    bool in_document() const
+    {
+        return depth > base;
+    }
 
-    // get key and remain
-    auto [key, remain] = get_first_field(field);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+    static bool is_space(char c)
     {
-        if (remain[0] == '"')
-        {
-            o_temp = this->get<json_object>(key);
-            i = 1;
-        }
-        if (remain[0] == '[')
-        {
-            a_temp = this->get<json_array>(key);
-            i = 2;
-        }
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
     }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
+    // calls complete(front, back) for each object ending in block, front is 0 for one begun in an earlier block;
+    // returns where an unfinished object starts, or npos. Jumps between the bytes that change its state within
+    // documents rather than stepping through every one; between them only whitespace, commas and the array's closing
+    // bracket are allowed, so anything else throws rather than being skipped
+    template <typename F>
+    size_t scan(std::string_view block, F &&complete)
     {
-        if (i == 1)
+        size_t start = in_document() ? 0 : std::string::npos;
+        for (size_t i = 0; i < block.size(); i++)
         {
-            if (remain[0] == '"')
+            if (!started)
             {
-                o_temp = o_temp.get<json_object>(key);
+                char c = block[i];
+                if (is_space(c))
+                    continue;
+                started = true;
+                if (c == '[') // data as array
+                {
+                    base = depth = 1;
+                    continue;
+                }
             }
 
-            if (remain[0] == '[')
+            if (!in_document())
             {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
+                char c = block[i];
+                if (c == '{' && !closed)
+                {
+                    start = i;
+                    depth++;
+                }
+                else if (c == ']' && base == 1 && !closed)
+                {
+                    closed = true;
+                }
+                else if (!is_space(c) && (c != ',' || closed))
+                {
+                    throw std::runtime_error(std::string("unexpected '") + c + "' between documents");
+                }
+                continue;
             }
-        }
-        else if (i == 2)
-        {
-            if (remain[0] == '"')
+
+            if (in_string)
             {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
+                if (escaped)
+                {
+                    escaped = false;
+                    continue;
+                }
+                i = scan_bytes(block, i, {{'"', '\\', '"', '"', '"'}});
+                if (i == block.size())
+                    break;
+                if (block[i] == '\\')
+                    escaped = true;
+                else
+                    in_string = false;
+                continue;
             }
 
-            if (remain[0] == '[')
+            i = scan_bytes(block, i, {{'"', '{', '[', '}', ']'}});
+            if (i == block.size())
+                break;
+            switch (block[i])
             {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
+            case '"':
+                in_string = true;
+                break;
+            case '{':
+            case '[':
+                depth++;
+                break;
+            case '}':
+            case ']':
+                depth--;
+                if (depth == base)
+                {
+                    complete(start, i + 1);
+                    start = std::string::npos;
+                }
+                break;
             }
         }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
-    }
-
-    if (i == 1)
-    {
-        return o_temp.get<bool>(key);
+        return start;
     }
-    return a_temp.get<bool>(std::stoi(key));
-}
+};
 
-template <>
-inline json_object Document::query<json_object>(const std::string &field) const
+// read only mapping of a whole file, held by the collection loaded from it and unmapped by clear_from_ram or when
+// that collection is destroyed; documents hold plain views into it, so updating or removing them doesn't release it
+class mapped_file
 {
-    json_object o_temp;
-    json_array a_temp;
-
-    // get key and remain
-    auto [key, remain] = get_first_field(field);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+public:
+    explicit mapped_file(const std::string &filepath)
     {
-        if (remain[0] == '"')
-        {
-            o_temp = this->get<json_object>(key);
-            i = 1;
-        }
-        if (remain[0] == '[')
+        int fd = ::open(filepath.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        struct stat info;
+        if (::fstat(fd, &info) == -1)
         {
-            a_temp = this->get<json_array>(key);
-            i = 2;
+            ::close(fd);
+            throw std::runtime_error("failed to stat file: " + filepath);
         }
-    }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
-    {
-        if (i == 1)
+        length = info.st_size;
+        if (length > 0)
         {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
-
-            if (remain[0] == '[')
+            void *address = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
             {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
+                ::close(fd);
+                throw std::runtime_error("failed to map file: " + filepath);
             }
+            region = static_cast<const char *>(address);
+            ::madvise(address, length, MADV_SEQUENTIAL);
         }
-        else if (i == 2)
-        {
+        ::close(fd);
+    }
 
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
 
-            if (remain[0] == '[')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
+    ~mapped_file()
+    {
+        if (region)
+            ::munmap(const_cast<char *>(region), length);
     }
 
-    if (i == 1)
+    std::string_view view() const
     {
-        return o_temp.get<json_object>(key);
+        return std::string_view(region, length);
     }
-    return a_temp.get<json_object>(std::stoi(key));
-}
 
-template <>
-inline json_array Document::query<json_array>(const std::string &field) const
+private:
+    const char *region = nullptr;
+    size_t length = 0;
+};
+
+// append-only storage for the json of a collection's documents, in large blocks so documents sit next to each
+// other in memory and adding one doesn't allocate. Space of json that's replaced or removed is only counted as
+// released; Collection::compact repacks the live json into a new arena to reclaim it
+class payload_arena
 {
-    json_object o_temp;
-    json_array a_temp;
+public:
+    // copies json into the arena; the view stays valid until the arena is cleared or destroyed
+    std::string_view store(std::string_view json)
+    {
+        char *dest = allocate(json.size());
+        std::memcpy(dest, json.data(), json.size());
+        return std::string_view(dest, json.size());
+    }
 
-    // get key and remain
-    auto [key, remain] = get_first_field(field);
-    key = key.substr(1, key.size() - 2);
-    int i;
-    if (remain != "")
+    // room for size bytes of json, to be written by the caller
+    char *allocate(size_t size)
     {
-        if (remain[0] == '"')
+        char *dest;
+        if (size > max_block_size / 4)
         {
-            o_temp = this->get<json_object>(key);
-            i = 1;
+            // large payloads get a block of their own, so the current block keeps filling
+            blocks.push_back(std::make_unique<char[]>(size));
+            dest = blocks.back().get();
+            capacity += size;
         }
-        if (remain[0] == '[')
+        else
         {
-            a_temp = this->get<json_array>(key);
-            i = 2;
+            if (!current || offset + size > current_size)
+            {
+                // blocks double with the arena, so small collections stay small
+                current_size = std::max(size, std::clamp(capacity, min_block_size, max_block_size));
+                blocks.push_back(std::make_unique<char[]>(current_size));
+                current = blocks.back().get();
+                offset = 0;
+                capacity += current_size;
+            }
+            dest = current + offset;
+            offset += size;
         }
+        allocated += size;
+        return dest;
     }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain != "")
+    void release(std::string_view json)
     {
-        if (i == 1)
-        {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
+        released += json.size();
+    }
 
-            if (remain[0] == '[')
-            {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
-            }
-        }
-        else if (i == 2)
-        {
+    void clear()
+    {
+        blocks.clear();
+        current = nullptr;
+        current_size = offset = 0;
+        capacity = allocated = released = 0;
+    }
 
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
+    // bytes held in blocks
+    size_t get_capacity() const
+    {
+        return capacity;
+    }
 
-            if (remain[0] == '[')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
+    // bytes stored, including released ones
+    size_t get_allocated() const
+    {
+        return allocated;
     }
 
-    if (i == 1)
+    size_t get_released() const
     {
-        return o_temp.get<json_array>(key);
+        return released;
     }
-    return a_temp.get<json_array>(std::stoi(key));
-}
 
-inline size_t Document::next_id = 0;
+private:
+    static constexpr size_t min_block_size = 1 << 12;
+    static constexpr size_t max_block_size = 1 << 20;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *current = nullptr; // block being filled by small payloads
+    size_t current_size = 0;
+    size_t offset = 0; // used bytes of current
+    size_t capacity = 0;
+    size_t allocated = 0;
+    size_t released = 0;
+};
 
-inline std::string Document::query_as_string(const std::string &path) const
+class Document
 {
-    json_object o_temp;
-    json_array a_temp;
+public:
+    Document()
+    {
+        id = next_id++;
+    }
+    Document(const std::string &json)
+    {
+        auto failure = minify_json(json, data);
+        if (failure) throw std::runtime_error(*failure);
+        id = next_id++;
+    }
+    Document(size_t id, const std::string &json)
+    {
+        auto failure = minify_json(json, data);
+        if (failure) throw std::runtime_error(*failure);
+        this->id = id;
+    }
 
-    // get key and remainder
-    auto [key, remain] = get_first_field(path);
-    key = key.substr(1, key.size() -2);
+    // copies always own their json, so they outlive the collection's mapped files and arena
+    Document(const Document &other) : id(other.id), data(other.json()), tape(other.tape), tombstone(other.tombstone)
+    {
+    }
 
-    if (remain == "")
-    { 
-        auto fields = tokenize_json(data);
-        for (size_t i = 0; i < fields.size(); i += 2)
+    Document &operator=(const Document &other)
+    {
+        if (this != &other)
         {
-            if (fields[i] == key)
-            {
-                return fields[i + 1];
-            }
+            id = other.id;
+            data = std::string(other.json());
+            view = std::string_view();
+            pooled = false;
+            tape = other.tape;
+            tombstone = other.tombstone;
         }
-        throw std::runtime_error("Field does not exist");
+        return *this;
     }
 
-    int i;
-    if (remain[0] == '"')
+    Document(Document &&) = default;
+    Document &operator=(Document &&) = default;
+
+    template <typename T>
+    T get(const std::string &field) const &
     {
-        o_temp = this->get<json_object>(key);
-        i = 1;
+        return json_value_as<T>(find_field(field));
     }
-    if (remain[0] == '[')
+
+    // objects and arrays from a temporary document, such as one returned by value, own a copy of their json
+    // since the document is gone once the statement ends
+    template <typename T>
+    T get(const std::string &field) const &&
     {
-        a_temp = this->get<json_array>(key);
-        i = 2;
+        return json_value_owned<T>(find_field(field));
     }
 
-    std::tie(key, remain) = get_first_field(remain);
-    key = key.substr(1, key.size() - 2);
-    while (remain.size() != 0)
+    template <typename T>
+    T query(const std::string &path) const &
     {
-        if (i == 1)
-        {
-            if (remain[0] == '"')
-            {
-                o_temp = o_temp.get<json_object>(key);
-            }
-            if (remain[0] == '{')
-            {
-                a_temp = o_temp.get<json_array>(key);
-                i = 2;
-            }
-        }
-        else
-        {
-            if (remain[0] == '"')
-            {
-                o_temp = a_temp.get<json_object>(std::stoi(key));
-                i = 1;
-            }
-            if (remain[0] == '{')
-            {
-                a_temp = a_temp.get<json_array>(std::stoi(key));
-            }
-        }
-        std::tie(key, remain) = get_first_field(remain);
-        key = key.substr(1, key.size() - 2);
+        return json_value_as<T>(query_ref(path));
     }
-    std::string s;
-    if (i == 1)
-        s = o_temp.get_as_string(key);
-    else
-        s = a_temp.get_as_string(std::stoi(key));
-    return s;
-    
-}
 
+    template <typename T>
+    T query(const std::string &path) const &&
+    {
+        return json_value_owned<T>(query_ref(path));
+    }
 
-class Collection
-{
-public:
-    Collection(const std::string &name)
-    { // TODO: Israel
-        this->name = name;
+    bool is_null(const std::string &field)
+    {
+        return find_field(field).value == "null";
     }
 
-    Collection(const std::string &name, const std::string &filepath)
-    { // TODO: Israel
-        this->name = name;
-        load_file = filepath;
-        if (!std::filesystem::exists(filepath))
-        {
-            throw std::runtime_error("filepath: " + filepath + " does not exist");
-        }
-        
+    // parses data into a tape so lookups walk nodes instead of re-tokenizing the string
+    void build_tape()
+    {
+        tape = build_json_tape(json());
     }
 
-    void load(const std::string &filepath)
+    void drop_tape()
     {
-        std::ifstream file(filepath);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file: " + filepath);
+        tape.clear();
+        tape.shrink_to_fit();
+    }
 
-        std::string buffer, filedata;
-        while (std::getline(file, buffer))
-        {
-            filedata += buffer;
-        }
-        auto e = tokenize_json(filedata);
-        for (size_t i = 0; i < e.size(); i += 2)
-        {
-            documents.emplace_back(std::stoi(e[i]), e[i + 1]);
-        }
-        file.close();
+    bool is_parsed() const
+    {
+        return !tape.empty();
     }
 
-    void cache(const std::string &filepath)
+    // true while the json is a view into a memory mapped file rather than owned
+    bool is_mapped() const
+    {
+        return view.data() != nullptr && !pooled;
+    }
+
+    size_t get_id() const
+    {
+        return id;
+    }
+
+    std::string to_string() const
+    {
+        std::stringstream ss;
+
+        auto print_tabs = [&ss](size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+            {
+                ss << '\t';
+            }
+        };
+
+        std::function<void(const std::string &, size_t)> stream_formatted_object;
+
+        std::function<void(const std::string &, size_t)> stream_formatted_array = [&](const std::string &data, size_t depth)
+        {
+            ss << '[';
+            auto tokens = tokenize_array(data);
+            if (tokens.size() == 0)
+            {
+                ss << ']';
+                return;
+            }
+            for (const auto &t : tokens)
+            {
+                ss << '\n';
+                print_tabs(depth + 1);
+                switch (t[0])
+                {
+                case '[':
+                    stream_formatted_array(t, depth + 1);
+                    break;
+                case '{':
+                    stream_formatted_object(t, depth + 1);
+                    break;
+                default:
+                    ss << t;
+                }
+                ss << ',';
+            }
+            ss.seekp(-1, ss.cur);
+            ss << '\n';
+            print_tabs(depth);
+            ss << ']';
+        };
+
+        stream_formatted_object = [&](const std::string &data, size_t depth)
+        {
+            ss << '{';
+            auto tokens = tokenize_json(data);
+            if (tokens.size() == 0)
+            {
+                ss << '}';
+                return;
+            }
+            for (size_t i = 0; i < tokens.size(); i += 2)
+            {
+                ss << '\n';
+                print_tabs(depth + 1);
+                ss << tokens[i] << ": ";
+                switch (tokens[i + 1][0])
+                {
+                case '[':
+                    stream_formatted_array(tokens[i + 1], depth + 1);
+                    break;
+                case '{':
+                    stream_formatted_object(tokens[i + 1], depth + 1);
+                    break;
+                default:
+                    ss << tokens[i + 1];
+                }
+                ss << ',';
+            }
+            ss.seekp(-1, ss.cur);
+            ss << '\n';
+            print_tabs(depth);
+            ss << '}';
+        };
+
+        ss << "Document " << id << ": ";
+        stream_formatted_object(std::string(json()), 0);
+        return ss.str();
+    }
+
+private:
+    // for data that's already been de_whitespaced and verified
+    struct verified_json
+    {
+    };
+
+    Document(verified_json, size_t id, std::string &&json) : id(id), data(std::move(json))
+    {
+    }
+
+    size_t id; // index in Collection, but when in a smaller subset will need access
+    static std::atomic<size_t> next_id; // for documents made outside a collection; collections number their own
+    std::string data; // as json, empty while viewed
+    std::string_view view; // span of a collection's mapped file or arena, used instead of data until the document changes
+    bool pooled = false; // view is into the collection's payload_arena
+    std::vector<json_node> tape; // empty unless parsed, must be rebuilt when data changes
+    bool tombstone = false; // removed from its collection, reclaimed at the next compaction
+
+    std::string query_as_string(const std::string &path) const;
+
+    std::string_view json() const
+    {
+        if (view.data())
+            return view;
+        return data;
+    }
+
+    json_ref root() const
+    {
+        std::string_view text = json();
+        if (!tape.empty())
+            return {text, text.data(), tape.data(), 0};
+        return {text};
+    }
+
+    json_ref find_field(std::string_view field) const
+    {
+        return json_ref_field(root(), field);
+    }
+
+    // walks a path, throwing with the same messages as the typed getters
+    json_ref query_ref(std::string_view path) const
+    {
+        path_lexer lexer(path);
+        path_token token;
+        if (!lexer.next(token) || token.is_index)
+        {
+            throw std::runtime_error("syntax issue: path must start with a key");
+        }
+
+        json_ref current = find_field(token.key);
+        while (lexer.next(token))
+        {
+            if (token.is_index)
+            {
+                if (current.value[0] != '[')
+                    throw std::runtime_error("Field is not an array");
+                current = json_ref_index(current, token.index);
+            }
+            else
+            {
+                if (current.value[0] != '{')
+                    throw std::runtime_error("Field is not an object");
+                current = json_ref_field(current, token.key);
+            }
+        }
+        return current;
+    }
+
+    // walks a parsed path without allocating; nullopt if the path doesn't exist in this document
+    std::optional<std::string_view> find_path(const std::vector<path_segment> &path) const
+    {
+        if (!tape.empty())
+        {
+            size_t node = 0;
+            for (const auto &segment : path)
+            {
+                if (segment.is_index)
+                {
+                    if (tape[node].type != '[')
+                        return std::nullopt;
+                    node = tape_find_index(tape.data(), node, segment.index);
+                }
+                else
+                {
+                    if (tape[node].type != '{')
+                        return std::nullopt;
+                    node = tape_find_field(json().data(), tape.data(), node, segment.key);
+                }
+                if (node == no_node)
+                    return std::nullopt;
+            }
+            return tape_value(json().data(), tape[node]);
+        }
+
+        std::optional<std::string_view> value = json();
+        for (const auto &segment : path)
+        {
+            if (segment.is_index)
+                value = json_find_index(*value, segment.index);
+            else
+                value = json_find_field(*value, segment.key);
+            if (!value)
+                return std::nullopt;
+        }
+        return value;
+    }
+
+    friend class Collection;
+    friend class uCollection;
+    friend class Filter;
+    friend class Projection;
+    friend class document_iterator;
+    friend class Database;
+};
+
+// splits a pattern into its paths, comparison operators and expected values
+inline std::tuple<std::vector<std::string>, std::vector<std::string>, std::vector<std::string>> tokenize_pattern(std::string pattern)
+{
+    // "field1"."field2"[2].data1
+
+    pattern = de_whitespace_json(pattern);
+
+    if (pattern.size() == 0)
+    {
+        throw std::runtime_error("no pattern");
+    }
+
+    //"field 1" = true & "field 2" = 3
+    size_t front = 0;
+    size_t back = 0;
+
+    // parse pattern
+    std::vector<std::string> keys;
+    std::vector<std::string> vals;
+
+    // split at '&'
+    while (back != pattern.size())
+    {
+        switch (pattern[back])
+        {
+        case '"':
+            back = match_quote(pattern, back);
+            break;
+        case '{':
+        case '[':
+            back = match_bracket(pattern, back);
+            break;
+        case '&':
+            keys.push_back(pattern.substr(front, back - front));
+            front = back + 1;
+            break;
+        default:
+            break;
+        }
+        back++;
+    }
+    keys.push_back(pattern.substr(front));
+    std::vector<std::string> ops;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        const std::string &key = keys.at(i);
+        back = 0;
+        while (back < key.size())
+        {
+            if (key[back] == '"')
+            {
+                back = match_quote(key, back);
+                if (back == std::string::npos)
+                    throw std::runtime_error("syntax issue: missing final quote");
+            }
+            if (key[back] == '=' || key[back] == '<' || key[back] == '>' || key[back] == '!' || key.compare(back, 3, "in[") == 0)
+            {
+                break;
+            }
+            back++;
+        }
+        if (back >= key.size())
+        {
+            throw std::runtime_error("syntax issue: missing comparison operator");
+        }
+        if (back == 0)
+        {
+            throw std::runtime_error("syntax issue: no key");
+        }
+
+        size_t length = 1;
+        if (key[back] == 'i' || (key[back] != '=' && back + 1 < key.size() && key[back + 1] == '='))
+            length = 2;
+        else if (key[back] == '!')
+            throw std::runtime_error("syntax issue: '!' must be followed by '='");
+        // no json value starts with one of these, so it's a mistyped operator such as == or =<
+        if (back + length < key.size() && std::strchr("=<>!", key[back + length]) != nullptr)
+            throw std::runtime_error("syntax issue: unknown comparison operator " + key.substr(back, length + 1));
+        ops.push_back(key.substr(back, length));
+        vals.push_back(key.substr(back + length));
+        keys.at(i) = key.substr(0, back);
+    }
+    return std::make_tuple(keys, ops, vals);
+}
+
+// returns the first key (with quotes) or index (with brackets) in query, and the rest of the path
+inline std::pair<std::string, std::string> get_first_field(std::string query)
+{
+    path_lexer lexer(query);
+    path_token token;
+    if (!lexer.next(token))
+    {
+        return {"", ""};
+    }
+
+    if (token.is_index)
+        return {std::string(token.key), std::string(lexer.remaining())};
+    return {'"' + std::string(token.key) + '"', std::string(lexer.remaining())};
+}
+
+inline std::atomic<size_t> Document::next_id = 0;
+
+inline std::string Document::query_as_string(const std::string &path) const
+{
+    return std::string(query_ref(path).value);
+}
+
+
+inline std::vector<path_segment> parse_path(const std::string &path)
+{
+    std::vector<path_segment> segments;
+    path_lexer lexer(path);
+    path_token token;
+    while (lexer.next(token))
+    {
+        segments.push_back({token.is_index, token.is_index ? "" : std::string(token.key), token.index});
+    }
+    return segments;
+}
+
+// a json value parsed for comparison: numbers by value, strings by their contents without quotes, anything
+// else by its text. Values of different kinds are never equal and sort by kind. text holds the json text,
+// without the quotes of a string
+enum class filter_kind : char
+{
+    number,
+    string,
+    other
+};
+
+template <typename Text>
+struct basic_filter_value
+{
+    filter_kind kind = filter_kind::other;
+    double num = 0;
+    Text text;
+
+    basic_filter_value() = default;
+
+    template <typename Other>
+    basic_filter_value(const basic_filter_value<Other> &other) : kind(other.kind), num(other.num), text(other.text)
+    {
+    }
+
+    // raw is a de_whitespaced json value, as found at a path
+    explicit basic_filter_value(std::string_view raw)
+    {
+        if (raw.size() >= 2 && raw.front() == '"' && raw.back() == '"')
+        {
+            kind = filter_kind::string;
+            text = Text(raw.substr(1, raw.size() - 2));
+            return;
+        }
+        if (!raw.empty() && (raw[0] == '-' || (raw[0] >= '0' && raw[0] <= '9')))
+        {
+            auto [end, error] = std::from_chars(raw.data(), raw.data() + raw.size(), num);
+            if (error == std::errc() && end == raw.data() + raw.size() && std::isfinite(num))
+            {
+                kind = filter_kind::number;
+                text = Text(raw);
+                return;
+            }
+            num = 0;
+        }
+        text = Text(raw);
+    }
+
+    template <typename Other>
+    int compare(const basic_filter_value<Other> &other) const
+    {
+        if (kind != other.kind)
+            return kind < other.kind ? -1 : 1;
+        if (kind == filter_kind::number)
+            return num < other.num ? -1 : (num > other.num ? 1 : 0);
+        return std::string_view(text).compare(std::string_view(other.text));
+    }
+
+    template <typename Other>
+    bool operator<(const basic_filter_value<Other> &other) const
+    {
+        return compare(other) < 0;
+    }
+
+    template <typename Other>
+    bool operator==(const basic_filter_value<Other> &other) const
+    {
+        return compare(other) == 0;
+    }
+};
+
+using filter_value = basic_filter_value<std::string>; // owns its text, for patterns and index keys
+using filter_value_view = basic_filter_value<std::string_view>; // views a document's json
+
+enum class filter_op
+{
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    in
+};
+
+// A filter pattern parsed once into path segments, operators and expected values, so it can be
+// run against many documents, and reused across calls, without re-tokenizing
+class Filter
+{
+public:
+    explicit Filter(const std::string &pattern) : pattern(pattern)
+    {
+        auto [keys, ops, vals] = tokenize_pattern(pattern);
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            condition c{keys[i], parse_path(keys[i]), parse_op(ops[i]), {}};
+            if (c.op == filter_op::in)
+            {
+                if (vals[i].size() < 2 || vals[i].front() != '[' || match_bracket(vals[i], 0) != vals[i].size() - 1)
+                    throw std::runtime_error("syntax issue: 'in' needs a bracketed list of values");
+                for (const std::string &v : tokenize_array(vals[i]))
+                {
+                    c.values.emplace_back(v);
+                }
+            }
+            else
+            {
+                c.values.emplace_back(vals[i]);
+            }
+            conditions.push_back(std::move(c));
+        }
+    }
+
+    // documents without a condition's path never match it, whatever the operator
+    bool matches(const Document &d) const
+    {
+        for (const auto &c : conditions)
+        {
+            auto value = d.find_path(c.segments);
+            if (!value || !c.holds(filter_value_view(*value)))
+                return false;
+        }
+        return true;
+    }
+
+    const std::string &get_pattern() const
+    {
+        return pattern;
+    }
+
+private:
+    std::string pattern;
+    struct condition
+    {
+        std::string path; // de_whitespaced, as used to key indexes
+        std::vector<path_segment> segments;
+        filter_op op;
+        std::vector<filter_value> values; // one, or the list for in
+
+        bool holds(const filter_value_view &v) const
+        {
+            const filter_value &expected = values.front();
+            switch (op)
+            {
+            case filter_op::eq:
+                return v == expected;
+            case filter_op::ne:
+                return !(v == expected);
+            case filter_op::in:
+                return std::any_of(values.begin(), values.end(), [&](const filter_value &e) { return v == e; });
+            default:
+                break;
+            }
+            // ordering only means something between numbers or between strings
+            if (v.kind != expected.kind || v.kind == filter_kind::other)
+                return false;
+            int order = v.compare(expected);
+            switch (op)
+            {
+            case filter_op::lt:
+                return order < 0;
+            case filter_op::le:
+                return order <= 0;
+            case filter_op::gt:
+                return order > 0;
+            default:
+                return order >= 0;
+            }
+        }
+    };
+    std::vector<condition> conditions;
+
+    static filter_op parse_op(const std::string &op)
+    {
+        if (op == "=") return filter_op::eq;
+        if (op == "!=") return filter_op::ne;
+        if (op == "<") return filter_op::lt;
+        if (op == "<=") return filter_op::le;
+        if (op == ">") return filter_op::gt;
+        if (op == ">=") return filter_op::ge;
+        return filter_op::in;
+    }
+
+    friend class Collection;
+};
+
+// Open addressing map from document id to slot in Collection::documents, so point lookups
+// don't depend on ids being sorted. Linear probing with backward shift deletion.
+class id_table
+{
+public:
+    // returns the slot for id, or npos
+    size_t find(size_t id) const
+    {
+        if (buckets.empty())
+            return std::string::npos;
+        for (size_t i = home(id);; i = (i + 1) & mask)
+        {
+            if (buckets[i].first == empty)
+                return std::string::npos;
+            if (buckets[i].first == id)
+                return buckets[i].second;
+        }
+    }
+
+    // inserts or overwrites the slot for id
+    void insert(size_t id, size_t slot)
+    {
+        if ((count + 1) * 2 > buckets.size())
+            grow(std::max<size_t>(16, buckets.size() * 2));
+
+        for (size_t i = home(id);; i = (i + 1) & mask)
+        {
+            if (buckets[i].first == empty)
+            {
+                buckets[i] = {id, slot};
+                count++;
+                return;
+            }
+            if (buckets[i].first == id)
+            {
+                buckets[i].second = slot;
+                return;
+            }
+        }
+    }
+
+    void erase(size_t id)
+    {
+        if (buckets.empty())
+            return;
+
+        size_t i = home(id);
+        while (buckets[i].first != id)
+        {
+            if (buckets[i].first == empty)
+                return;
+            i = (i + 1) & mask;
+        }
+
+        // shift later entries of the probe run back so lookups don't stop at the hole
+        for (size_t j = (i + 1) & mask; buckets[j].first != empty; j = (j + 1) & mask)
+        {
+            size_t h = home(buckets[j].first);
+            if (((j - h) & mask) >= ((j - i) & mask))
+            {
+                buckets[i] = buckets[j];
+                i = j;
+            }
+        }
+        buckets[i].first = empty;
+        count--;
+    }
+
+    void reserve(size_t n)
+    {
+        size_t capacity = 16;
+        while (capacity < n * 2)
+            capacity *= 2;
+        if (capacity > buckets.size())
+            grow(capacity);
+    }
+
+    void clear()
+    {
+        buckets.clear();
+        count = 0;
+        mask = 0;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+private:
+    static constexpr size_t empty = std::numeric_limits<size_t>::max();
+    std::vector<std::pair<size_t, size_t>> buckets; // id, slot
+    size_t count = 0;
+    size_t mask = 0;
+
+    size_t home(size_t id) const
+    {
+        size_t h = id * 0x9E3779B97F4A7C15ull;
+        return (h ^ (h >> 32)) & mask;
+    }
+
+    void grow(size_t capacity)
+    {
+        std::vector<std::pair<size_t, size_t>> old(capacity, {empty, 0});
+        old.swap(buckets);
+        mask = capacity - 1;
+        count = 0;
+        for (const auto &[id, slot] : old)
+        {
+            if (id != empty)
+                insert(id, slot);
+        }
+    }
+};
+
+// the number of documents aggregated, and the count, sum, min and max of the numbers at the aggregated path
+// among them; values that aren't numbers, and documents without the path, add to count only. While values is 0,
+// min is +infinity and max is -infinity, so merging partial results needs no special case
+struct aggregate_result
+{
+    size_t count = 0;
+    size_t values = 0;
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    // the mean of the numbers, or NaN if there were none
+    double avg() const
+    {
+        return values ? sum / values : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    void add(const std::optional<std::string_view> &value)
+    {
+        count++;
+        if (!value)
+            return;
+        filter_value_view v(*value);
+        if (v.kind != filter_kind::number)
+            return;
+        values++;
+        sum += v.num;
+        min = std::min(min, v.num);
+        max = std::max(max, v.num);
+    }
+
+    void merge(const aggregate_result &other)
+    {
+        count += other.count;
+        values += other.values;
+        sum += other.sum;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+    }
+};
+
+// aggregate results keyed by the value they were grouped by
+using aggregate_groups = std::map<filter_value, aggregate_result, std::less<>>;
+
+// one matching document's values at the paths of a Projection, in the same order; values are json text
+struct projected_row
+{
+    size_t id;
+    std::vector<std::optional<std::string>> values; // nullopt where the document lacks the path
+
+    bool has(size_t column) const
+    {
+        return values.at(column).has_value();
+    }
+
+    // the value in column as T, like Document::query; throws if the document lacks the path
+    template <typename T>
+    T get(size_t column) const
+    {
+        if (!has(column))
+            throw std::runtime_error("Path does not exist");
+        return json_value_as<T>(json_ref{*values[column]});
+    }
+};
+
+// A list of paths parsed once, so get_documents can copy out just those values while it scans
+class Projection
+{
+public:
+    explicit Projection(const std::vector<std::string> &paths) : paths(paths)
+    {
+        if (paths.empty())
+            throw std::runtime_error("projection has no paths");
+        for (const auto &path : paths)
+        {
+            segments.push_back(parse_path(path));
+        }
+    }
+
+    projected_row extract(const Document &d) const
+    {
+        projected_row row{d.get_id(), {}};
+        row.values.reserve(segments.size());
+        for (const auto &path : segments)
+        {
+            auto value = d.find_path(path);
+            row.values.push_back(value ? std::optional<std::string>(*value) : std::nullopt);
+        }
+        return row;
+    }
+
+    const std::vector<std::string> &get_paths() const
+    {
+        return paths;
+    }
+
+private:
+    std::vector<std::string> paths;
+    std::vector<std::vector<path_segment>> segments;
+};
+
+// secondary index from the value at a path, sorted as filters compare values, to the ids of the documents holding it
+struct path_index
+{
+    std::map<filter_value, std::set<size_t>, std::less<>> ids;
+};
+
+// an update tokenized once, with object values parsed into nested patches, so it can be applied to many documents
+struct update_patch
+{
+    std::vector<std::string> fields; // alternating keys and values, as from tokenize_json
+    std::vector<update_patch> objects; // the patch for each object value, empty for other values
+    std::vector<std::string> replacements; // each value as written over another or appended; objects lose their deletes
+    std::vector<std::string> members; // "key":replacement for each field, appended when the key is missing
+    std::vector<bool> repeated; // the key appears again later in the patch, which wins
+    size_t keys = 0; // distinct keys
+    bool deletes = false; // some value is delete
+
+    update_patch() = default;
+
+    explicit update_patch(const std::string &data) : fields(tokenize_json(data))
+    {
+        objects.reserve(fields.size() / 2);
+        replacements.reserve(fields.size() / 2);
+        members.reserve(fields.size() / 2);
+        for (size_t i = 1; i < fields.size(); i += 2)
+        {
+            objects.push_back(fields[i][0] == '{' ? update_patch(fields[i]) : update_patch());
+            replacements.push_back(fields[i][0] == '{' ? objects.back().without_deletes() : fields[i]);
+            members.push_back('"' + fields[i - 1] + "\":" + replacements.back());
+            bool later = false;
+            for (size_t j = i + 1; j < fields.size(); j += 2)
+            {
+                later = later || fields[j] == fields[i - 1];
+            }
+            repeated.push_back(later);
+            keys += !later;
+            deletes = deletes || fields[i] == "delete";
+        }
+    }
+
+    size_t size() const
+    {
+        return members.size();
+    }
+
+    const std::string &key(size_t i) const
+    {
+        return fields[2 * i];
+    }
+
+    const std::string &value(size_t i) const
+    {
+        return fields[2 * i + 1];
+    }
+
+    // the object this patch was made from as it is written where there's no object to patch: fields set to delete
+    // are dropped at every depth, and a repeated key only keeps its last value
+    std::string without_deletes() const
+    {
+        std::string ret = "{";
+        for (size_t i = 0; i < size(); i++)
+        {
+            if (repeated[i] || value(i) == "delete")
+                continue;
+            if (ret.size() > 1)
+                ret += ',';
+            ret += members[i];
+        }
+        ret += '}';
+        return ret;
+    }
+};
+
+// a range of a document's json and what replaces it, as planned by plan_patch
+struct json_edit
+{
+    size_t begin;
+    size_t end;
+    std::string_view text; // into the update_patch
+    bool comma = false; // text is a member appended after others, so it needs a ',' first
+
+    size_t size() const
+    {
+        return text.size() + comma;
+    }
+};
+
+// finds the edits that apply patch to object, a de_whitespaced object at offset in its document. Fields with an
+// object value patch an object they find recursively and replace any other value; "delete" removes the field,
+// and missing fields are appended. Objects written whole leave out their delete fields. Edits come out in position
+// order and never overlap
+inline void plan_patch(std::string_view object, size_t offset, const update_patch &patch, std::vector<json_edit> &edits)
+{
+    struct member
+    {
+        std::string_view key;
+        size_t key_begin; // the opening quote of the key
+        size_t value_begin;
+        size_t value_end;
+        bool deleted;
+    };
+
+    // without deletions the walk can stop once every key is found, so a patch near the front of a large
+    // document doesn't scan the rest of it
+    size_t unmatched = patch.deletes ? std::string::npos : patch.keys;
+    std::vector<bool> matched(patch.size());
+    std::vector<member> members;
+    size_t back = 0;
+    while (object.size() > 2 && back < object.size() - 1 && unmatched > 0)
+    {
+        size_t front = back + 1;
+        back = match_quote(object, front);
+        if (back == std::string::npos || back + 2 >= object.size())
+            break;
+        std::string_view key = object.substr(front + 1, back - front - 1);
+        size_t value_begin = back + 2;
+        back = json_value_end(object, value_begin);
+        members.push_back({key, front, value_begin, back, false});
+        for (size_t i = 0; i < patch.size() && unmatched != std::string::npos; i++)
+        {
+            if (!matched[i] && !patch.repeated[i] && patch.key(i) == key)
+            {
+                matched[i] = true;
+                unmatched--;
+            }
+        }
+    }
+
+    size_t first_edit = edits.size();
+    size_t kept = members.size();
+    std::vector<size_t> appended;
+    for (size_t i = 0; i < patch.size(); i++)
+    {
+        if (patch.repeated[i])
+            continue;
+
+        const std::string &value = patch.value(i);
+        bool found = false;
+        for (member &m : members)
+        {
+            if (m.key != patch.key(i))
+                continue;
+            found = true;
+
+            std::string_view old_value = object.substr(m.value_begin, m.value_end - m.value_begin);
+            if (value == "delete")
+            {
+                m.deleted = true;
+                kept--;
+            }
+            else if (value[0] == '{' && old_value[0] == '{')
+            {
+                plan_patch(old_value, offset + m.value_begin, patch.objects[i], edits);
+            }
+            else if (old_value != patch.replacements[i])
+            {
+                edits.push_back({offset + m.value_begin, offset + m.value_end, patch.replacements[i]});
+            }
+        }
+        if (!found && value != "delete")
+            appended.push_back(i);
+    }
+
+    size_t close = offset + object.size() - 1;
+    for (size_t i : appended)
+    {
+        edits.push_back({close, close, patch.members[i], kept > 0 || i != appended.front()});
+    }
+
+    // a deleted field takes the comma after it, or the one before it when no kept field follows
+    for (size_t i = 0; i < members.size(); i++)
+    {
+        if (!members[i].deleted)
+            continue;
+        bool kept_after = false;
+        for (size_t j = i + 1; j < members.size() && !kept_after; j++)
+        {
+            kept_after = !members[j].deleted;
+        }
+        size_t begin = kept_after || i == 0 ? members[i].key_begin : members[i - 1].value_end;
+        size_t end = kept_after ? members[i + 1].key_begin : members[i].value_end;
+        edits.push_back({offset + begin, offset + end, std::string_view()});
+    }
+
+    std::stable_sort(edits.begin() + first_edit, edits.end(), [](const json_edit &a, const json_edit &b)
+    {
+        return a.begin < b.begin;
+    });
+}
+
+// walks the documents of a collection, skipping removed ones that haven't been compacted away yet
+class document_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = Document;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Document *;
+    using reference = const Document &;
+
+    document_iterator(std::vector<Document>::const_iterator it, std::vector<Document>::const_iterator last) : it(it), last(last)
+    {
+        skip_tombstones();
+    }
+
+    reference operator*() const
+    {
+        return *it;
+    }
+
+    pointer operator->() const
+    {
+        return &*it;
+    }
+
+    document_iterator &operator++()
+    {
+        ++it;
+        skip_tombstones();
+        return *this;
+    }
+
+    document_iterator operator++(int)
+    {
+        document_iterator old = *this;
+        ++*this;
+        return old;
+    }
+
+    bool operator==(const document_iterator &other) const
+    {
+        return it == other.it;
+    }
+
+    bool operator!=(const document_iterator &other) const
+    {
+        return it != other.it;
+    }
+
+private:
+    std::vector<Document>::const_iterator it, last;
+
+    void skip_tombstones()
+    {
+        while (it != last && it->tombstone)
+            ++it;
+    }
+};
+
+class Collection
+{
+public:
+    Collection(const std::string &name)
+    { // TODO: Israel
+        this->name = name;
+    }
+
+    Collection(const std::string &name, const std::string &filepath)
+    { // TODO: Israel
+        this->name = name;
+        load_file = filepath;
+        if (!std::filesystem::exists(filepath))
+        {
+            throw std::runtime_error("filepath: " + filepath + " does not exist");
+        }
+        
+    }
+
+    void load(const std::string &filepath)
+    {
+        std::ifstream file(filepath);
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        std::string buffer, filedata;
+        while (std::getline(file, buffer))
+        {
+            filedata += buffer;
+        }
+        size_t first = documents.size();
+        auto e = tokenize_json(filedata);
+        for (size_t i = 0; i < e.size(); i += 2)
+        {
+            documents.emplace_back(std::stoi(e[i]), e[i + 1]);
+        }
+        file.close();
+        claim_ids(first);
+        prepare_documents(first);
+        mark_loaded(first);
+    }
+
+    void cache(const std::string &filepath)
     {
         std::ofstream file(filepath);
         if (!file.is_open())
             throw std::runtime_error("failed to open file: " + filepath);
-        file << "{\n";
-        for (const auto &d : documents)
+        file << "{\n";
+        bool first = true;
+        for (const auto &d : documents)
+        {
+            if (d.tombstone)
+                continue;
+            if (!first)
+                file << ",\n";
+            file << '"' << d.id << "\":" << d.json();
+            first = false;
+        }
+        file << "\n}";
+        file.close();
+    }
+
+    // writes live documents in the binary cache format: a header, then per document its id, json and
+    // tape sizes followed by the already verified json and, when parsed, its tape
+    void cache_binary(const std::string &filepath)
+    {
+        std::ofstream file(filepath, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        auto write_u64 = [&file](uint64_t n)
+        {
+            file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+        };
+
+        file.write(binary_cache_magic, sizeof(binary_cache_magic));
+        write_u64(size());
+        for (const auto &d : documents)
+        {
+            if (d.tombstone)
+                continue;
+            std::string_view json = d.json();
+            write_u64(d.id);
+            write_u64(json.size());
+            write_u64(d.tape.size());
+            file.write(json.data(), json.size());
+            file.write(reinterpret_cast<const char *>(d.tape.data()), d.tape.size() * sizeof(json_node));
+        }
+        file.close();
+    }
+
+    // reads a file written by cache_binary in one pass, without re-verifying or re-parsing documents
+    void load_binary(const std::string &filepath)
+    {
+        std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        std::string buffer(file.tellg(), '\0');
+        file.seekg(0);
+        file.read(buffer.data(), buffer.size());
+        file.close();
+
+        size_t pos = 0;
+        auto read_u64 = [&]()
+        {
+            if (pos + sizeof(uint64_t) > buffer.size())
+                throw std::runtime_error("invalid cache file: " + filepath);
+            uint64_t n;
+            std::memcpy(&n, buffer.data() + pos, sizeof(n));
+            pos += sizeof(n);
+            return n;
+        };
+
+        if (buffer.compare(0, sizeof(binary_cache_magic), binary_cache_magic, sizeof(binary_cache_magic)) != 0)
+            throw std::runtime_error("invalid cache file: " + filepath);
+        pos = sizeof(binary_cache_magic);
+
+        // decoded aside and appended only once the whole file checks out, so a truncated or corrupt cache throws
+        // with the collection as it was and the caller can load it from elsewhere. Tapes are kept without re-parsing,
+        // so each is checked to stay within its json
+        uint64_t count = read_u64();
+        if (count > (buffer.size() - pos) / (3 * sizeof(uint64_t)))
+            throw std::runtime_error("invalid cache file: " + filepath);
+        std::vector<Document> cached;
+        cached.reserve(count);
+        std::vector<size_t> ids;
+        ids.reserve(count);
+        for (uint64_t i = 0; i < count; i++)
+        {
+            uint64_t id = read_u64();
+            if (locate(id) != std::string::npos)
+                throw std::runtime_error("invalid cache file: " + filepath);
+            ids.push_back(id);
+            uint64_t json_size = read_u64();
+            uint64_t tape_size = read_u64();
+            if (json_size > buffer.size() - pos || tape_size > (buffer.size() - pos - json_size) / sizeof(json_node))
+                throw std::runtime_error("invalid cache file: " + filepath);
+
+            cached.push_back(Document(Document::verified_json{}, id, buffer.substr(pos, json_size)));
+            pos += json_size;
+            if (preparsed) // tapes from before set_preparsed(false) are dropped
+            {
+                Document &d = cached.back();
+                d.tape.resize(tape_size);
+                std::memcpy(d.tape.data(), buffer.data() + pos, tape_size * sizeof(json_node));
+                if (!json_tape_fits(d.tape, d.json()))
+                    throw std::runtime_error("invalid cache file: " + filepath);
+            }
+            pos += tape_size * sizeof(json_node);
+        }
+        if (pos != buffer.size())
+            throw std::runtime_error("invalid cache file: " + filepath);
+        std::sort(ids.begin(), ids.end());
+        if (std::adjacent_find(ids.begin(), ids.end()) != ids.end())
+            throw std::runtime_error("invalid cache file: " + filepath);
+
+        size_t first = documents.size();
+        grow_documents(cached.size());
+        std::move(cached.begin(), cached.end(), std::back_inserter(documents));
+        claim_ids(first);
+        prepare_documents(first);
+    }
+
+    // writes what changed since the last checkpoint to the next segment file, <directory>/<name>.<n>.seg. The first
+    // checkpoint into a directory is a base segment holding every live document; later ones hold only the documents
+    // added or updated since, and the ids removed since. Changes are tracked per collection, so keep to one directory
+    void checkpoint(const std::string &directory)
+    {
+        auto segments = checkpoint_segments(directory);
+        bool base = segments.empty();
+        size_t seq = base ? 0 : segments.back().first + 1;
+
+        std::vector<std::pair<size_t, std::string_view>> records;
+        if (base)
+        {
+            for (const auto &d : documents)
+            {
+                if (!d.tombstone)
+                    records.emplace_back(d.id, d.json());
+            }
+        }
+        else
+        {
+            if (dirty.empty() && removed.empty())
+                return;
+            for (size_t id : dirty)
+            {
+                size_t slot = locate(id);
+                if (slot != std::string::npos)
+                    records.emplace_back(id, documents[slot].json());
+            }
+        }
+
+        write_segment(segment_path(directory, seq), base, records, base ? std::set<size_t>() : removed);
+        dirty.clear();
+        removed.clear();
+    }
+
+    // replaces the documents with the state recorded by the segments in directory: the latest base segment
+    // with every later one applied in order
+    void load_checkpoint(const std::string &directory)
+    {
+        auto state = read_segments(directory);
+        clear_from_ram();
+        dirty.clear();
+        removed.clear();
+
+        documents.reserve(state.size());
+        for (auto &[id, json] : state)
+        {
+            documents.push_back(Document(Document::verified_json{}, id, std::move(json)));
+        }
+        claim_ids(0);
+        prepare_documents(0);
+    }
+
+    // folds the segments in directory into one base segment, so loading reads each document once; the new segment
+    // is written before the old ones are removed, so a crash part way leaves a loadable directory
+    void merge_checkpoints(const std::string &directory)
+    {
+        auto segments = checkpoint_segments(directory);
+        if (segments.size() < 2)
+            return;
+
+        auto state = read_segments(directory);
+        std::vector<std::pair<size_t, std::string_view>> records(state.begin(), state.end());
+        write_segment(segment_path(directory, segments.back().first + 1), true, records, std::set<size_t>());
+        for (const auto &[seq, path] : segments)
+        {
+            std::filesystem::remove(path);
+        }
+    }
+
+    // streams the file in blocks, verifying each batch of documents in parallel
+    void read(const std::string &filepath)
+    {
+        if (memory_mapped)
+        {
+            read_mapped(filepath);
+            return;
+        }
+
+        std::ifstream file(filepath, std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        size_t first = documents.size();
+        document_splitter splitter;
+        std::vector<std::string> batch;
+        std::string block(read_block_size, '\0');
+        try
+        {
+            while (file.read(block.data(), block.size()) || file.gcount() > 0)
+            {
+                splitter.feed(std::string_view(block.data(), file.gcount()), batch);
+                if (batch.size() >= read_batch_size)
+                {
+                    add_raw_documents(batch);
+                    batch.clear();
+                }
+            }
+            add_raw_documents(batch);
+            if (splitter.incomplete())
+                throw std::runtime_error("file ends inside a document: " + filepath);
+        }
+        catch (...)
+        {
+            // leave the collection as it was before the read
+            documents.erase(documents.begin() + first, documents.end());
+            throw;
+        }
+        file.close();
+        prepare_documents(first);
+        mark_loaded(first);
+    }
+
+    // written beside filepath and renamed over it, so documents still mapped from filepath stay readable
+    void save(const std::string &filepath)
+    {
+        std::ofstream file(filepath + ".tmp");
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+        file << "[\n";
+        bool first = true;
+        for (const auto &d : documents)
+        {
+            if (d.tombstone)
+                continue;
+            if (!first)
+                file << ",\n";
+            file << '\t' << d.json();
+            first = false;
+        }
+        file << (first ? "]" : "\n]");
+
+        file.close();
+        if (!file)
+            throw std::runtime_error("failed to write file: " + filepath);
+        std::filesystem::rename(filepath + ".tmp", filepath);
+    }
+
+    const std::string &get_name()
+    {
+        return name;
+    }
+
+    void change_name(const std::string &new_name)
+    {
+        name = new_name;
+    } // TODO:
+
+    // reads collection files through mmap, leaving documents as views into the file until they're updated
+    void set_memory_mapped(bool enabled)
+    {
+        memory_mapped = enabled;
+    }
+
+    bool is_memory_mapped() const
+    {
+        return memory_mapped;
+    }
+
+    // keeps every document parsed into a tape, trading memory for faster lookups in filters
+    void set_preparsed(bool enabled)
+    {
+        preparsed = enabled;
+        if (enabled)
+        {
+            parse_documents(0);
+            return;
+        }
+        for (Document &d : documents)
+        {
+            d.drop_tape();
+        }
+    }
+
+    bool is_preparsed() const
+    {
+        return preparsed;
+    }
+
+    document_iterator begin() const
+    {
+        return document_iterator(documents.cbegin(), documents.cend());
+    }
+
+    document_iterator end() const
+    {
+        return document_iterator(documents.cend(), documents.cend());
+    }
+
+    // approximate bytes held in RAM by the documents, their json and tapes
+    size_t memory_usage() const
+    {
+        size_t bytes = documents.capacity() * sizeof(Document);
+        for (const Document &d : documents)
+        {
+            bytes += d.data.capacity() + d.tape.capacity() * sizeof(json_node);
+        }
+        return bytes + arena.get_capacity();
+    }
+
+    // number of live documents
+    size_t size() const
+    {
+        return documents.size() - tombstones;
+    }
+
+    // removed documents still holding a slot until the next compaction
+    size_t get_tombstone_count() const
+    {
+        return tombstones;
+    }
+
+    // compacts once removed documents make up at least this fraction of the slots, 0 compacts on every removal
+    void set_compaction_threshold(double fraction)
+    {
+        if (fraction < 0 || fraction > 1)
+        {
+            throw std::runtime_error("compaction threshold must be between 0 and 1");
+        }
+        compaction_threshold = fraction;
+        maybe_compact();
+    }
+
+    // drops removed documents from storage, keeping the order of the rest, and repacks the arena their json is
+    // stored in so space left by updates and removals is reclaimed
+    void compact()
+    {
+        if (tombstones > 0)
+            drop_tombstones();
+        if (arena.get_released() > 0)
+            repack_payloads();
+    }
+
+    // claims the block of ids [first, first + count) and returns first. Needs no lock, so ingest threads can take
+    // blocks up front and add their documents with add_document(id, json) later
+    size_t reserve_ids(size_t count)
+    {
+        return next_id->fetch_add(count);
+    }
+
+    // C
+    // adds with a given id, as when replaying a log or from a block of reserve_ids; later ids are handed out after it
+    size_t add_document(size_t id, const std::string &json)
+    {
+        if (locate(id) != std::string::npos)
+        {
+            throw std::runtime_error("document with id already exists: " + std::to_string(id));
+        }
+        documents.emplace_back(id, json);
+        claim_id(id);
+        pool_payload(documents.back());
+        if (preparsed)
+            documents.back().build_tape();
+        slots.insert(id, documents.size() - 1);
+        index_document(documents.back());
+        mark_dirty(id);
+        return id;
+    }
+
+    size_t add_document(const std::string &json)
+    {
+
+        documents.emplace_back(next_id->fetch_add(1), json);
+        pool_payload(documents.back());
+        if (preparsed)
+            documents.back().build_tape();
+        slots.insert(documents.back().id, documents.size() - 1);
+        index_document(documents.back());
+        mark_dirty(documents.back().id);
+        return documents.back().get_id();
+    } // TODO:
+
+    // adds many documents at once: storage grows at most once, the documents are verified in parallel and get a
+    // contiguous range of ids, returned as [first, last). Throws, adding nothing, if any document is invalid
+    std::pair<size_t, size_t> add_documents(std::vector<std::string> &&jsons)
+    {
+        size_t first = documents.size();
+        auto ids = add_raw_documents(jsons);
+        prepare_documents(first);
+        mark_loaded(first);
+        return ids;
+    }
+
+    // add_documents for a buffer of objects laid out like a collection file: back to back, or in an array
+    std::pair<size_t, size_t> add_documents_from_buffer(std::string_view buffer)
+    {
+        document_splitter splitter;
+        std::vector<std::string_view> spans;
+        splitter.split(buffer, spans);
+        if (splitter.incomplete())
+            throw std::runtime_error("buffer ends inside a document");
+
+        size_t first = documents.size();
+        auto ids = add_raw_documents(spans);
+        prepare_documents(first);
+        mark_loaded(first);
+        return ids;
+    }
+
+    // R
+    const Document &get_document(size_t id)
+    {
+        size_t slot = locate(id);
+        if (slot == std::string::npos)
+        {
+            throw std::runtime_error("Could not find document with id: " + std::to_string(id));
+        }
+        return documents[slot];
+    }
+
+    // pointers into the collection, valid until the next add, update or remove
+    std::vector<const Document *> get_document_refs(const Filter &filter, bool parallel)
+    {
+        return collect_matches(filter, parallel, [](const Document &d)
+        {
+            return &d;
+        });
+    }
+
+    std::vector<const Document *> get_document_refs(const std::string &pattern, bool parallel)
+    {
+        return get_document_refs(Filter(pattern), parallel);
+    }
+
+    // copying convenience wrapper around get_document_refs
+    const std::vector<Document> get_documents(const Filter &filter, bool parallel)
+    {
+        auto refs = get_document_refs(filter, parallel);
+
+        std::vector<Document> result_vector;
+        result_vector.reserve(refs.size());
+        for (const Document *d : refs)
+        {
+            result_vector.push_back(*d);
+        }
+        return result_vector;
+    }
+
+    const std::vector<Document> get_documents(const std::string &pattern, bool parallel)
+    {
+        return get_documents(Filter(pattern), parallel);
+    }
+
+    // only the projected values of each match, copied out as the documents are scanned
+    std::vector<projected_row> get_documents(const Filter &filter, const Projection &projection, bool parallel)
+    {
+        return collect_matches(filter, parallel, [&projection](const Document &d)
+        {
+            return projection.extract(d);
+        });
+    }
+
+    size_t count_documents(const Filter &filter, bool parallel)
+    {
+        auto partials = fold_matches<size_t>(filter, parallel, [](size_t &n, const Document &)
+        {
+            n++;
+        });
+        size_t count = 0;
+        for (size_t partial : partials)
+        {
+            count += partial;
+        }
+        return count;
+    }
+
+    // aggregates the numbers at path over the matching documents without copying any
+    aggregate_result aggregate(const Filter &filter, const std::string &path, bool parallel)
+    {
+        const auto segments = parse_path(path);
+        auto partials = fold_matches<aggregate_result>(filter, parallel, [&](aggregate_result &r, const Document &d)
+        {
+            r.add(d.find_path(segments));
+        });
+        aggregate_result result;
+        for (const auto &partial : partials)
+        {
+            result.merge(partial);
+        }
+        return result;
+    }
+
+    // aggregate, with a result per value at group_by; documents without group_by are left out. Equal numbers in
+    // different forms share a group, keyed by the form in the document with the lowest id, so the key doesn't
+    // depend on how the scan was split between threads
+    aggregate_groups aggregate_by(const Filter &filter, const std::string &path, const std::string &group_by, bool parallel)
+    {
+        struct group
+        {
+            size_t first_id;
+            filter_value key;
+            aggregate_result result;
+        };
+        using partial_groups = std::map<filter_value, group, std::less<>>;
+
+        const auto segments = parse_path(path);
+        const auto group_segments = parse_path(group_by);
+        auto partials = fold_matches<partial_groups>(filter, parallel, [&](partial_groups &g, const Document &d)
+        {
+            auto key = d.find_path(group_segments);
+            if (!key)
+                return;
+            filter_value_view view(*key);
+            auto found = g.find(view);
+            if (found == g.end())
+                found = g.emplace(filter_value(view), group{d.id, filter_value(view), aggregate_result()}).first;
+            else if (d.id < found->second.first_id)
+                found->second = group{d.id, filter_value(view), found->second.result};
+            found->second.result.add(d.find_path(segments));
+        });
+
+        partial_groups merged;
+        for (const auto &partial : partials)
+        {
+            for (const auto &[key, g] : partial)
+            {
+                auto [found, added] = merged.emplace(key, g);
+                if (added)
+                    continue;
+                if (g.first_id < found->second.first_id)
+                {
+                    found->second.first_id = g.first_id;
+                    found->second.key = g.key;
+                }
+                found->second.result.merge(g.result);
+            }
+        }
+
+        aggregate_groups result;
+        for (auto &[key, g] : merged)
+        {
+            result.emplace_hint(result.end(), std::move(g.key), g.result);
+        }
+        return result;
+    }
+
+    // U
+    void update_document(size_t id, const std::string &data)
+    {
+        std::string formatted_data;
+        auto failure = minify_json(data, formatted_data);
+        if (failure) throw std::runtime_error(*failure);
+
+        size_t slot = locate(id);
+        if (slot == std::string::npos)
+        {
+            throw std::runtime_error("Could not find document with id: " + std::to_string(id));
+        }
+
+        apply_update(documents[slot], update_patch(formatted_data));
+        maybe_compact();
+    }
+
+    void update_documents(const Filter &filter, const std::string &data, bool parallel)
+    {
+
+        // check if documents exist in collection
+        if (size() == 0)
+        {
+            throw std::runtime_error("no documents exist in collection");
+        }
+
+        // verified and tokenized once for every matching document
+        std::string formatted_data;
+        auto failure = minify_json(data, formatted_data);
+        if (failure) throw std::runtime_error(*failure);
+        const update_patch patch(formatted_data);
+
+        if (auto candidates = indexed_ids(filter))
+        {
+            std::vector<size_t> matched;
+            for (size_t id : *candidates)
+            {
+                size_t slot = locate(id);
+                if (filter.matches(documents[slot]))
+                    matched.push_back(slot);
+            }
+            for (size_t slot : matched)
+            {
+                apply_update(documents[slot], patch);
+            }
+        }
+        else if (!parallel)
+        {
+            // iterate through all documents in documents vector
+            for (Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                {
+                    apply_update(d, patch);
+                }
+            }
+        }
+        else
+        {
+            // iterate through all documents in documents vector
+            #pragma omp parallel for shared(documents) shared(filter) shared(patch)
+            for (Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                {
+                    apply_update(d, patch);
+                }
+            }
+        }
+        maybe_compact();
+    }
+
+    void update_documents(const std::string &pattern, const std::string &data, bool parallel)
+    {
+        update_documents(Filter(pattern), data, parallel);
+    }
+
+    // D
+    void remove_document(size_t id)
+    {
+        size_t slot = locate(id);
+        if (slot == std::string::npos)
+        {
+            throw std::runtime_error("Could not find document with id: " + std::to_string(id));
+        }
+
+        bury(slot);
+        maybe_compact();
+    }
+
+    void remove_documents(const Filter &filter, bool parallel)
+    {
+
+        // check if documents exist in collection
+        if (size() == 0)
+        {
+            throw std::runtime_error("no documents exist in collection");
+        }
+
+        if (auto candidates = indexed_ids(filter))
+        {
+            for (size_t id : *candidates)
+            {
+                size_t slot = locate(id);
+                if (filter.matches(documents[slot]))
+                    bury(slot);
+            }
+            maybe_compact();
+            return;
+        }
+
+        if (!parallel)
+        {
+            // burying leaves every other document in its slot, so this can mark while iterating
+            for (size_t i = 0; i < documents.size(); i++)
+            {
+                if (!documents[i].tombstone && filter.matches(documents[i]))
+                {
+                    bury(i);
+                }
+            }
+            maybe_compact();
+            return;
+        }
+
+        // match in parallel, bury serially since the slot table isn't thread safe
+        int num_threads = omp_get_max_threads();
+        std::vector<std::vector<size_t>> result_vector(num_threads);
+
+        #pragma omp parallel shared(documents) shared(result_vector)
+        {
+            int id = omp_get_thread_num();
+
+            #pragma omp for
+            for (size_t i = 0; i < documents.size(); i++)
+            {
+                if (!documents[i].tombstone && filter.matches(documents[i]))
+                {
+                    result_vector[id].push_back(i);
+                }
+            }
+        }
+
+        for (const auto &matched : result_vector)
+        {
+            for (size_t slot : matched)
+            {
+                bury(slot);
+            }
+        }
+        maybe_compact();
+    }
+
+    void remove_documents(const std::string &pattern, bool parallel)
+    {
+        remove_documents(Filter(pattern), parallel);
+    }
+
+    // builds an index on path so equality filters on it don't scan the collection
+    void create_index(const std::string &path)
+    {
+        std::string key = de_whitespace_json(path);
+        if (indexes.count(key))
+        {
+            throw std::runtime_error("index already exists on path: " + key);
+        }
+
+        path_index &index = indexes[key];
+        for (const Document &d : documents)
+        {
+            if (d.tombstone)
+                continue;
+            try
+            {
+                index.ids[filter_value(d.query_as_string(key))].insert(d.id);
+            }
+            catch (...)
+            {
+                // documents without the path aren't indexed
+            }
+        }
+    }
+
+    void drop_index(const std::string &path)
+    {
+        if (indexes.erase(de_whitespace_json(path)) == 0)
+        {
+            throw std::runtime_error("no index on path: " + path);
+        }
+    }
+
+    std::vector<std::string> get_indexed_paths() const
+    {
+        std::vector<std::string> ret;
+        for (const auto &[path, index] : indexes)
+        {
+            ret.push_back(path);
+        }
+        return ret;
+    }
+
+private:
+    std::string name;
+    std::vector<Document> documents;
+    friend class Database;
+    void clear_from_ram()
+    {
+        documents.clear();
+        mappings.clear();
+        arena.clear();
+        tombstones = 0;
+        slots.clear();
+        for (auto &[path, index] : indexes)
+        {
+            index.ids.clear();
+        }
+    }
+    std::string cache_file;
+    std::string load_file;
+    bool preparsed = false;
+    bool memory_mapped = false;
+    std::vector<std::shared_ptr<const mapped_file>> mappings; // files that documents may hold views into
+    payload_arena arena; // holds the json of documents that aren't views into mappings
+    std::map<std::string, path_index> indexes; // keyed by de_whitespaced path
+    id_table slots;
+    std::unique_ptr<std::shared_mutex> mutex = std::make_unique<std::shared_mutex>(); // taken by Database, boxed so collections stay movable
+    bool resident = false; // documents are in RAM rather than in load_file or the temp cache
+    std::unique_ptr<std::atomic<uint64_t>> last_used = std::make_unique<std::atomic<uint64_t>>(0); // Database's use clock, for LRU eviction
+    std::unique_ptr<std::atomic<size_t>> next_id = std::make_unique<std::atomic<size_t>>(0); // ids are unique within a collection and ascend as documents are added
+    size_t tombstones = 0;
+    double compaction_threshold = 0.25;
+    std::set<size_t> dirty; // ids added or updated since the last checkpoint
+    std::set<size_t> removed; // ids removed since the last checkpoint
+
+    // returns the slot of the document with id, or npos
+    size_t locate(size_t id) const
+    {
+        return slots.find(id);
+    }
+
+    // applies an update in place, keeping the document's indexes and tape current; safe to call for different documents in parallel
+    // splices the patch into the document's json: edits that keep their length are written over pooled json in
+    // place, anything else is copied once into new room in the arena, so no document is re-tokenized
+    void apply_update(Document &d, const update_patch &patch)
+    {
+        std::string_view json = d.json();
+        std::vector<json_edit> edits;
+        plan_patch(json, 0, patch, edits);
+
+        unindex_document(d);
+        bool same_size = std::all_of(edits.begin(), edits.end(), [](const json_edit &e)
+        {
+            return e.size() == e.end - e.begin;
+        });
+        if (edits.empty() || (d.pooled && same_size))
+        {
+            char *out = const_cast<char *>(json.data()); // the arena's memory, only ever viewed as const
+            for (const json_edit &e : edits)
+            {
+                std::memcpy(out + e.begin, e.text.data(), e.text.size());
+            }
+        }
+        else
+        {
+            size_t size = json.size();
+            for (const json_edit &e : edits)
+            {
+                size += e.size() - (e.end - e.begin);
+            }
+
+            char *out;
+            #pragma omp critical(collection_arena)
+            {
+                release_payload(d);
+                out = arena.allocate(size);
+            }
+
+            char *next = out;
+            size_t copied = 0;
+            for (const json_edit &e : edits)
+            {
+                next = std::copy(json.begin() + copied, json.begin() + e.begin, next);
+                if (e.comma)
+                    *next++ = ',';
+                next = std::copy(e.text.begin(), e.text.end(), next);
+                copied = e.end;
+            }
+            std::copy(json.begin() + copied, json.end(), next);
+
+            d.view = std::string_view(out, size);
+            d.pooled = true;
+            std::string().swap(d.data);
+        }
+        if (preparsed)
+            d.build_tape();
+        index_document(d);
+        #pragma omp critical(collection_dirty)
+        mark_dirty(d.id);
+    }
+
+    // drops removed documents from storage, keeping the order of the rest
+    void drop_tombstones()
+    {
+        int num_threads = omp_get_max_threads();
+        std::vector<std::vector<Document>> result_vector(num_threads);
+
+        // static schedule hands out chunks in thread order, so concatenating keeps document order
+        #pragma omp parallel shared(documents) shared(result_vector)
+        {
+            int id = omp_get_thread_num();
+
+            #pragma omp for schedule(static)
+            for (Document &d : documents)
+            {
+                if (!d.tombstone)
+                {
+                    result_vector[id].emplace_back(std::move(d));
+                }
+            }
+        }
+
+        for (size_t i = 1; i < result_vector.size(); i++)
+        {
+            result_vector[0].reserve(result_vector[i].size() + result_vector[0].size());
+            std::move(result_vector[i].begin(), result_vector[i].end(), std::back_inserter(result_vector[0]));
+        }
+
+        documents = std::move(result_vector[0]);
+        tombstones = 0;
+        slots.clear();
+        map_documents(0);
+    }
+
+    // moves json the document owns into the arena
+    void pool_payload(Document &d)
+    {
+        if (d.view.data() || d.data.empty())
+            return;
+        d.view = arena.store(d.data);
+        d.pooled = true;
+        std::string().swap(d.data);
+    }
+
+    // counts the document's pooled json as released, before it's replaced or removed
+    void release_payload(Document &d)
+    {
+        if (d.pooled)
+            arena.release(d.view);
+    }
+
+    // stores the pooled json of live documents, in order, in a new arena and drops the old one. Any write may get
+    // here through maybe_compact, so wrappers viewing into any document of the collection dangle after one
+    void repack_payloads()
+    {
+        payload_arena packed;
+        for (Document &d : documents)
+        {
+            if (d.pooled)
+                d.view = packed.store(d.view);
+        }
+        arena = std::move(packed);
+    }
+
+    // marks the document in slot as removed without moving any other document
+    void bury(size_t slot)
+    {
+        Document &d = documents[slot];
+        unindex_document(d);
+        slots.erase(d.id);
+        d.tombstone = true;
+        release_payload(d);
+        d.data = std::string();
+        d.view = std::string_view();
+        d.pooled = false;
+        d.drop_tape();
+        tombstones++;
+        dirty.erase(d.id);
+        removed.insert(d.id);
+    }
+
+    void maybe_compact()
+    {
+        if ((tombstones > 0 && tombstones >= compaction_threshold * documents.size()) ||
+            (arena.get_released() > 0 && arena.get_released() >= compaction_threshold * arena.get_allocated()))
+        {
+            compact();
+        }
+    }
+
+    static constexpr char segment_magic[8] = {'D', 'B', 'S', 'E', 'G', 'M', 'T', '1'};
+
+    std::string segment_path(const std::string &directory, size_t seq) const
+    {
+        return directory + '/' + name + '.' + std::to_string(seq) + ".seg";
+    }
+
+    // this collection's segment files in directory, by sequence number
+    std::vector<std::pair<size_t, std::string>> checkpoint_segments(const std::string &directory) const
+    {
+        if (!std::filesystem::is_directory(directory))
+            throw std::runtime_error("checkpoint directory does not exist: " + directory);
+
+        std::vector<std::pair<size_t, std::string>> segments;
+        const std::string prefix = name + '.';
+        const std::string suffix = ".seg";
+        for (const auto &entry : std::filesystem::directory_iterator(directory))
+        {
+            std::string file = entry.path().filename().string();
+            if (file.size() <= prefix.size() + suffix.size() || file.compare(0, prefix.size(), prefix) != 0 ||
+                file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0)
+                continue;
+            std::string seq = file.substr(prefix.size(), file.size() - prefix.size() - suffix.size());
+            if (!std::all_of(seq.begin(), seq.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                continue;
+            segments.emplace_back(std::stoull(seq), entry.path().string());
+        }
+        std::sort(segments.begin(), segments.end());
+        return segments;
+    }
+
+    // a header and base flag, then per record its id, json size and json, then the removed ids; written
+    // under a temporary name and renamed so a segment is never seen half written
+    static void write_segment(const std::string &filepath, bool base, const std::vector<std::pair<size_t, std::string_view>> &records,
+                              const std::set<size_t> &removed_ids)
+    {
+        std::ofstream file(filepath + ".tmp", std::ios::binary);
+        if (!file.is_open())
+            throw std::runtime_error("failed to open file: " + filepath);
+
+        auto write_u64 = [&file](uint64_t n)
+        {
+            file.write(reinterpret_cast<const char *>(&n), sizeof(n));
+        };
+
+        file.write(segment_magic, sizeof(segment_magic));
+        write_u64(base);
+        write_u64(records.size());
+        for (const auto &[id, json] : records)
+        {
+            write_u64(id);
+            write_u64(json.size());
+            file.write(json.data(), json.size());
+        }
+        write_u64(removed_ids.size());
+        for (size_t id : removed_ids)
+        {
+            write_u64(id);
+        }
+        file.close();
+        if (!file)
+            throw std::runtime_error("failed to write file: " + filepath);
+        std::filesystem::rename(filepath + ".tmp", filepath);
+    }
+
+    // the documents, by id, that the segments in directory add up to
+    std::map<size_t, std::string> read_segments(const std::string &directory) const
+    {
+        auto segments = checkpoint_segments(directory);
+        if (segments.empty())
+            throw std::runtime_error("no checkpoint of " + name + " in: " + directory);
+
+        std::map<size_t, std::string> state;
+        for (const auto &[seq, filepath] : segments)
+        {
+            std::ifstream file(filepath, std::ios::binary | std::ios::ate);
+            if (!file.is_open())
+                throw std::runtime_error("failed to open file: " + filepath);
+            std::string buffer(file.tellg(), '\0');
+            file.seekg(0);
+            file.read(buffer.data(), buffer.size());
+            file.close();
+
+            size_t pos = 0;
+            auto read_u64 = [&]()
+            {
+                if (pos + sizeof(uint64_t) > buffer.size())
+                    throw std::runtime_error("invalid segment file: " + filepath);
+                uint64_t n;
+                std::memcpy(&n, buffer.data() + pos, sizeof(n));
+                pos += sizeof(n);
+                return n;
+            };
+
+            if (buffer.compare(0, sizeof(segment_magic), segment_magic, sizeof(segment_magic)) != 0)
+                throw std::runtime_error("invalid segment file: " + filepath);
+            pos = sizeof(segment_magic);
+
+            if (read_u64())
+                state.clear();
+            for (uint64_t count = read_u64(); count > 0; count--)
+            {
+                uint64_t id = read_u64();
+                uint64_t json_size = read_u64();
+                if (pos + json_size > buffer.size())
+                    throw std::runtime_error("invalid segment file: " + filepath);
+                state[id] = buffer.substr(pos, json_size);
+                pos += json_size;
+            }
+            for (uint64_t count = read_u64(); count > 0; count--)
+            {
+                state.erase(read_u64());
+            }
+        }
+        return state;
+    }
+
+    // raises next_id past an id given from outside, as by a file or a log replay, so it isn't handed out again
+    void claim_id(size_t id)
+    {
+        size_t next = next_id->load();
+        while (next <= id && !next_id->compare_exchange_weak(next, id + 1))
+        {
+        }
+    }
+
+    void claim_ids(size_t first)
+    {
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            claim_id(documents[i].id);
+        }
+    }
+
+    void mark_dirty(size_t id)
+    {
+        removed.erase(id);
+        dirty.insert(id);
+    }
+
+    // documents[first...] came from a file, so the next checkpoint has to write them
+    void mark_loaded(size_t first)
+    {
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            mark_dirty(documents[i].id);
+        }
+    }
+
+    static constexpr char binary_cache_magic[8] = {'D', 'B', 'C', 'A', 'C', 'H', 'E', '1'};
+    static constexpr size_t read_block_size = 1 << 20;
+    static constexpr size_t read_batch_size = 4096;
+
+    // minifies and verifies raw documents in parallel, then appends them in order with a contiguous range of
+    // new ids, returned as [first, last); nothing is added if any document fails. Strings that are already
+    // minified are moved in rather than copied
+    template <typename Text>
+    std::pair<size_t, size_t> add_raw_documents(std::vector<Text> &raw)
+    {
+        std::vector<std::string> minified(raw.size());
+        std::vector<std::optional<std::string>> failures(raw.size());
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < raw.size(); i++)
+        {
+            if constexpr (std::is_same_v<Text, std::string>)
+            {
+                if (json_is_minified(raw[i]))
+                {
+                    failures[i] = verify_minified_json(raw[i]);
+                    minified[i] = std::move(raw[i]);
+                    continue;
+                }
+            }
+            failures[i] = minify_json(raw[i], minified[i]);
+        }
+
+        for (const auto &failure : failures)
+        {
+            if (failure) throw std::runtime_error(*failure);
+        }
+
+        size_t first_id = reserve_ids(raw.size());
+        grow_documents(raw.size());
+        for (size_t i = 0; i < raw.size(); i++)
+        {
+            documents.push_back(Document(Document::verified_json{}, first_id + i, std::move(minified[i])));
+        }
+        return {first_id, first_id + raw.size()};
+    }
+
+    // adds documents logged with their ids and stored json, as verified when they were first read. replace drops
+    // every document first, as load_checkpoint does; loaded marks them for the next checkpoint, as load and read do.
+    // next is the next id the collection had when they were logged
+    void restore_documents(std::vector<std::pair<size_t, std::string>> &records, bool replace, bool loaded, size_t next)
+    {
+        if (replace)
+        {
+            clear_from_ram();
+            dirty.clear();
+            removed.clear();
+        }
+
+        size_t first = documents.size();
+        grow_documents(records.size());
+        for (auto &[id, json] : records)
+        {
+            documents.push_back(Document(Document::verified_json{}, id, std::move(json)));
+        }
+        claim_ids(first);
+        if (next > 0)
+            claim_id(next - 1);
+        prepare_documents(first);
+        if (loaded)
+            mark_loaded(first);
+    }
+
+    // makes room for count more documents. Capacity at least doubles, so callers appending in batches, as read does
+    // per read_batch_size documents, don't copy the documents already stored on every batch
+    void grow_documents(size_t count)
+    {
+        if (documents.size() + count > documents.capacity())
+            documents.reserve(std::max(documents.size() + count, 2 * documents.capacity()));
+    }
+
+    // splits a mapped file in place; documents already minified stay views into it, others are copied
+    void read_mapped(const std::string &filepath)
+    {
+        auto mapping = std::make_shared<const mapped_file>(filepath);
+        document_splitter splitter;
+        std::vector<std::string_view> spans;
+        splitter.split(mapping->view(), spans);
+        if (splitter.incomplete())
+            throw std::runtime_error("file ends inside a document: " + filepath);
+
+        std::vector<std::string> owned(spans.size());
+        std::vector<std::optional<std::string>> failures(spans.size());
+
+        #pragma omp parallel for
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            if (json_is_minified(spans[i]))
+            {
+                failures[i] = verify_minified_json(spans[i]);
+                continue;
+            }
+            failures[i] = minify_json(spans[i], owned[i]);
+        }
+
+        for (const auto &failure : failures)
+        {
+            if (failure) throw std::runtime_error(*failure);
+        }
+
+        size_t first = documents.size();
+        size_t first_id = reserve_ids(spans.size());
+        documents.reserve(first + spans.size());
+        for (size_t i = 0; i < spans.size(); i++)
+        {
+            documents.push_back(Document(Document::verified_json{}, first_id + i, std::move(owned[i])));
+            if (documents.back().data.empty())
+                documents.back().view = spans[i];
+        }
+        mappings.push_back(std::move(mapping));
+        prepare_documents(first);
+        mark_loaded(first);
+    }
+
+    void map_documents(size_t first)
+    {
+        slots.reserve(documents.size());
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            slots.insert(documents[i].id, i);
+        }
+    }
+
+    // make(d) for every document matching the filter, in document order or, through an index, id order
+    template <typename F>
+    std::vector<std::invoke_result_t<F, const Document &>> collect_matches(const Filter &filter, bool parallel, F make) const
+    {
+        using result = std::invoke_result_t<F, const Document &>;
+
+        // check if documents exist in collection
+        if (size() == 0)
+        {
+            throw std::runtime_error("no documents exist in collection");
+        }
+
+        // resolve through an index instead of scanning when one covers a key
+        if (auto candidates = indexed_ids(filter))
+        {
+            std::vector<result> result_vector;
+            for (size_t id : *candidates)
+            {
+                const Document &d = documents[locate(id)];
+                if (filter.matches(d))
+                {
+                    result_vector.push_back(make(d));
+                }
+            }
+            return result_vector;
+        }
+
+        // Single threaded implementation
+        if (!parallel)
+        {
+            std::vector<result> result_vector;
+            for (const Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                {
+                    result_vector.push_back(make(d));
+                }
+            }
+            return result_vector;
+        }
+
+        // Parallel implementation
+        int num_threads = omp_get_max_threads();
+        std::vector<std::vector<result>> result_vector(num_threads);
+
+        // static schedule hands out chunks in thread order, so concatenating keeps document order
+        #pragma omp parallel shared(documents) shared(result_vector)
+        {
+            int id = omp_get_thread_num();
+
+            #pragma omp for schedule(static)
+            for (const Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                {
+                    result_vector[id].push_back(make(d));
+                }
+            }
+        }
+
+        for(size_t i = 1; i < result_vector.size(); i++)
+        {
+            std::move(result_vector[i].begin(), result_vector[i].end(), std::back_inserter(result_vector[0]));
+        }
+        return std::move(result_vector[0]);
+    }
+
+    // runs add(partial, d) for each matching document, accumulating into one partial per thread, and returns
+    // the partials for the caller to merge
+    template <typename Partial, typename F>
+    std::vector<Partial> fold_matches(const Filter &filter, bool parallel, F add) const
+    {
+        if (auto candidates = indexed_ids(filter))
+        {
+            std::vector<Partial> partials(1);
+            for (size_t id : *candidates)
+            {
+                const Document &d = documents[locate(id)];
+                if (filter.matches(d))
+                    add(partials[0], d);
+            }
+            return partials;
+        }
+
+        if (!parallel)
+        {
+            std::vector<Partial> partials(1);
+            for (const Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                    add(partials[0], d);
+            }
+            return partials;
+        }
+
+        std::vector<Partial> partials(omp_get_max_threads());
+
+        #pragma omp parallel shared(documents) shared(partials)
+        {
+            // accumulate locally so threads don't share cache lines while scanning
+            Partial local{};
+
+            #pragma omp for nowait
+            for (const Document &d : documents)
+            {
+                if (!d.tombstone && filter.matches(d))
+                    add(local, d);
+            }
+            partials[omp_get_thread_num()] = std::move(local);
+        }
+        return partials;
+    }
+
+    // ids of the documents that can match the filter, in id order, taken from the first indexed key whose
+    // operator the sorted index can answer
+    std::optional<std::vector<size_t>> indexed_ids(const Filter &filter) const
+    {
+        for (const auto &c : filter.conditions)
+        {
+            auto index = indexes.find(c.path);
+            if (index == indexes.end() || c.op == filter_op::ne)
+                continue;
+            const auto &ids = index->second.ids;
+            const filter_value &v = c.values.front();
+            if (c.op != filter_op::eq && c.op != filter_op::in && v.kind == filter_kind::other)
+                continue;
+
+            std::vector<size_t> ret;
+            auto collect = [&](auto first, auto last)
+            {
+                for (; first != last; ++first)
+                    ret.insert(ret.end(), first->second.begin(), first->second.end());
+            };
+            // the first entry of a kind, so ranges don't cross from numbers into strings
+            auto kind_begin = [&](filter_kind kind)
+            {
+                filter_value least;
+                least.kind = kind;
+                least.num = -std::numeric_limits<double>::infinity();
+                return ids.lower_bound(least);
+            };
+            filter_kind next_kind = v.kind == filter_kind::number ? filter_kind::string : filter_kind::other;
+
+            switch (c.op)
+            {
+            case filter_op::eq:
+            case filter_op::in:
+                for (const filter_value &e : c.values)
+                {
+                    auto entry = ids.find(e);
+                    if (entry != ids.end())
+                        collect(entry, std::next(entry));
+                }
+                break;
+            case filter_op::lt:
+                collect(kind_begin(v.kind), ids.lower_bound(v));
+                break;
+            case filter_op::le:
+                collect(kind_begin(v.kind), ids.upper_bound(v));
+                break;
+            case filter_op::gt:
+                collect(ids.upper_bound(v), kind_begin(next_kind));
+                break;
+            default:
+                collect(ids.lower_bound(v), kind_begin(next_kind));
+                break;
+            }
+            std::sort(ret.begin(), ret.end());
+            ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+            return ret;
+        }
+        return std::nullopt;
+    }
+
+    void index_document(const Document &d)
+    {
+        if (indexes.empty())
+            return;
+
+        #pragma omp critical(collection_index)
+        for (auto &[path, index] : indexes)
+        {
+            try
+            {
+                index.ids[filter_value(d.query_as_string(path))].insert(d.id);
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+
+    void unindex_document(const Document &d)
+    {
+        if (indexes.empty())
+            return;
+
+        #pragma omp critical(collection_index)
+        for (auto &[path, index] : indexes)
+        {
+            try
+            {
+                auto entry = index.ids.find(filter_value_view(d.query_as_string(path)));
+                if (entry == index.ids.end())
+                    continue;
+                entry->second.erase(d.id);
+                if (entry->second.empty())
+                    index.ids.erase(entry);
+            }
+            catch (...)
+            {
+            }
+        }
+    }
+
+    void index_documents(size_t first)
+    {
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            index_document(documents[i]);
+        }
+    }
+
+    // maps, indexes and, when preparsed, parses documents[first...] after a bulk load
+    void prepare_documents(size_t first)
+    {
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            pool_payload(documents[i]);
+        }
+        map_documents(first);
+        index_documents(first);
+        parse_documents(first);
+    }
+
+    // builds tapes for documents[first...] when the collection is preparsed
+    void parse_documents(size_t first)
+    {
+        if (!preparsed)
+            return;
+
+        #pragma omp parallel for
+        for (size_t i = first; i < documents.size(); i++)
+        {
+            if (!documents[i].is_parsed())
+                documents[i].build_tape();
+        }
+    }
+};
+
+// a mutation as logged by Database: an op code then fields, each string prefixed by its length
+class wal_record
+{
+public:
+    explicit wal_record(char op)
+    {
+        payload.push_back(op);
+    }
+
+    wal_record &add(uint64_t n)
+    {
+        payload.append(reinterpret_cast<const char *>(&n), sizeof(n));
+        return *this;
+    }
+
+    wal_record &add(std::string_view field)
+    {
+        add(field.size());
+        payload.append(field);
+        return *this;
+    }
+
+    const std::string &get_payload() const
+    {
+        return payload;
+    }
+
+private:
+    std::string payload;
+};
+
+// reads the fields of a logged record back in the order they were added
+class wal_reader
+{
+public:
+    explicit wal_reader(std::string_view payload) : payload(payload), pos(1)
+    {
+        if (payload.empty())
+            throw std::runtime_error("malformed log record");
+    }
+
+    char op() const
+    {
+        return payload[0];
+    }
+
+    uint64_t next_u64()
+    {
+        if (pos + sizeof(uint64_t) > payload.size())
+            throw std::runtime_error("malformed log record");
+        uint64_t n;
+        std::memcpy(&n, payload.data() + pos, sizeof(n));
+        pos += sizeof(n);
+        return n;
+    }
+
+    std::string next_string()
+    {
+        uint64_t size = next_u64();
+        if (pos + size > payload.size())
+            throw std::runtime_error("malformed log record");
+        std::string ret(payload.substr(pos, size));
+        pos += size;
+        return ret;
+    }
+
+private:
+    std::string_view payload;
+    size_t pos;
+};
+
+// append only log of mutations. Each record is framed by its length and a checksum so a write torn by a crash is
+// dropped on recovery. Appends are buffered and written by whichever committer gets there first, so concurrent
+// writers share one write and fsync
+class write_ahead_log
+{
+public:
+    enum class sync_policy
+    {
+        every_commit, // commit returns once the record is fsynced
+        batched,      // fsynced when the buffer fills, by a background thread every batch_interval, and on close
+        none          // written when the buffer fills and every batch_interval, left to the OS to flush
+    };
+
+    static constexpr size_t batch_bytes = 1 << 20;
+    static constexpr std::chrono::milliseconds batch_interval{100};
+    static constexpr size_t rewrite_bytes = 1 << 20;
+
+    write_ahead_log(const std::string &filepath, sync_policy policy) : filepath(filepath), policy(policy)
+    {
+        fd = ::open(filepath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if (fd == -1)
+            throw std::runtime_error("failed to open file: " + filepath);
+        struct stat info;
+        if (::fstat(fd, &info) == 0)
+            written = rewritten = info.st_size;
+        last_sync = std::chrono::steady_clock::now();
+        if (policy != sync_policy::every_commit)
+            flusher = std::thread([this]() { flush_periodically(); });
+    }
+
+    write_ahead_log(const write_ahead_log &) = delete;
+    write_ahead_log &operator=(const write_ahead_log &) = delete;
+
+    ~write_ahead_log()
+    {
+        if (flusher.joinable())
+        {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            flusher.join();
+        }
+        try
+        {
+            flush();
+        }
+        catch (...)
+        {
+        }
+        ::close(fd);
+    }
+
+    // payloads of every intact record, cutting the file back to the end of the last one
+    std::vector<std::string> recover()
+    {
+        std::vector<std::string> records;
+        std::ifstream file(filepath, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        file.close();
+
+        size_t pos = 0;
+        while (pos + 8 <= data.size())
+        {
+            uint32_t size, sum;
+            std::memcpy(&size, data.data() + pos, 4);
+            std::memcpy(&sum, data.data() + pos + 4, 4);
+            if (pos + 8 + size > data.size() || checksum(std::string_view(data).substr(pos + 8, size)) != sum)
+                break;
+            records.push_back(data.substr(pos + 8, size));
+            pos += 8 + size;
+        }
+
+        if (pos != data.size() && ::ftruncate(fd, pos) == -1)
+            throw std::runtime_error("failed to truncate log: " + filepath);
+        written = rewritten = pos;
+        return records;
+    }
+
+    // buffers a record, returning its sequence number for commit
+    uint64_t append(const wal_record &record)
+    {
+        std::lock_guard lock(mutex);
+        frame(record, buffer);
+        return ++appended;
+    }
+
+    // makes the record with sequence number lsn as durable as the policy asks
+    void commit(uint64_t lsn)
+    {
+        std::unique_lock lock(mutex);
+        switch (policy)
+        {
+        case sync_policy::every_commit:
+            while (synced < lsn)
+            {
+                if (flushing)
+                {
+                    flushed.wait(lock);
+                    continue;
+                }
+                write_buffer(lock, true);
+            }
+            break;
+        case sync_policy::batched:
+            while (flushing)
+                flushed.wait(lock);
+            if (buffer.size() >= batch_bytes || std::chrono::steady_clock::now() - last_sync >= batch_interval)
+                write_buffer(lock, true);
+            break;
+        case sync_policy::none:
+            while (flushing)
+                flushed.wait(lock);
+            if (buffer.size() >= batch_bytes)
+                write_buffer(lock, false);
+            break;
+        }
+    }
+
+    // writes and fsyncs everything appended so far
+    void flush()
+    {
+        std::unique_lock lock(mutex);
+        while (flushing)
+            flushed.wait(lock);
+        write_buffer(lock, true);
+    }
+
+    // whether the log has grown past rewrite_bytes and to twice what it was last rewritten to (or opened at), so
+    // rewriting it costs no more than the logging that grew it did
+    bool should_rewrite()
+    {
+        std::lock_guard lock(mutex);
+        size_t size = written + buffer.size();
+        return size >= rewrite_bytes && size >= 2 * rewritten;
+    }
+
+    // replaces everything logged so far with records, which have to leave the same state when replayed. Written
+    // beside the log and renamed over it, so a crash part way leaves the old log
+    void rewrite(const std::vector<wal_record> &records)
+    {
+        std::string data;
+        for (const wal_record &record : records)
+        {
+            frame(record, data);
+        }
+
+        std::unique_lock lock(mutex);
+        while (flushing)
+            flushed.wait(lock);
+
+        std::string tmp = filepath + ".tmp";
+        int tmp_fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (tmp_fd == -1)
+            throw std::runtime_error("failed to open file: " + tmp);
+        if (!write_all(tmp_fd, data) || ::fsync(tmp_fd) == -1)
+        {
+            ::close(tmp_fd);
+            throw std::runtime_error("failed to write log: " + tmp);
+        }
+        std::filesystem::rename(tmp, filepath);
+        ::close(fd);
+        fd = tmp_fd;
+
+        buffer.clear();
+        synced = appended;
+        written = rewritten = data.size();
+        last_sync = std::chrono::steady_clock::now();
+    }
+
+private:
+    std::string filepath;
+    sync_policy policy;
+    int fd;
+    std::mutex mutex;
+    std::condition_variable flushed;
+    std::string buffer;
+    uint64_t appended = 0; // sequence number of the last buffered record
+    uint64_t synced = 0;   // sequence number of the last record written out
+    size_t written = 0;    // bytes in the file
+    size_t rewritten = 0;  // bytes in the file when it was last rewritten or opened
+    bool flushing = false;
+    std::chrono::steady_clock::time_point last_sync;
+    std::thread flusher; // bounds how long a record waits in the buffer when commits don't write it
+    std::condition_variable wake;
+    bool stopping = false;
+
+    // FNV-1a
+    static uint32_t checksum(std::string_view data)
+    {
+        uint32_t hash = 2166136261u;
+        for (char c : data)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    // writes whatever was appended every batch_interval until the log closes, so records committed without a write
+    // don't wait for the next commit to reach the file
+    void flush_periodically()
+    {
+        std::unique_lock lock(mutex);
+        while (!stopping)
+        {
+            wake.wait_for(lock, batch_interval);
+            if (stopping || flushing || buffer.empty())
+                continue;
+            try
+            {
+                write_buffer(lock, policy == sync_policy::batched);
+            }
+            catch (...)
+            {
+                // nobody is waiting on this write; a failing file fails the next commit or close that writes too
+            }
+        }
+    }
+
+    // appends record to out behind its length and checksum
+    static void frame(const wal_record &record, std::string &out)
+    {
+        const std::string &payload = record.get_payload();
+        uint32_t size = payload.size();
+        uint32_t sum = checksum(payload);
+        out.append(reinterpret_cast<const char *>(&size), 4);
+        out.append(reinterpret_cast<const char *>(&sum), 4);
+        out.append(payload);
+    }
+
+    static bool write_all(int fd, std::string_view data)
+    {
+        size_t written = 0;
+        while (written < data.size())
+        {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n == -1)
+                return false;
+            written += n;
+        }
+        return true;
+    }
+
+    // writes the buffer outside the lock so other writers keep appending to the next batch
+    void write_buffer(std::unique_lock<std::mutex> &lock, bool sync)
+    {
+        std::string batch;
+        batch.swap(buffer);
+        uint64_t batch_end = appended;
+        flushing = true;
+        lock.unlock();
+
+        bool failed = !write_all(fd, batch);
+        if (!failed && sync && ::fsync(fd) == -1)
+            failed = true;
+
+        lock.lock();
+        flushing = false;
+        if (!failed)
+        {
+            synced = batch_end;
+            written += batch.size();
+        }
+        if (sync)
+            last_sync = std::chrono::steady_clock::now();
+        flushed.notify_all();
+        if (failed)
+            throw std::runtime_error("failed to write log: " + filepath);
+    }
+};
+
+class Database
+{
+public:
+    Database(const std::string &filepath)
+    {
+        current_collection = collections.end();
+        current_collection_set = false;
+        temp_filepath = filepath;
+        if (!std::filesystem::exists(filepath))
+        {
+            throw std::runtime_error("filepath: " + filepath + " does not exist");
+        }
+    } // TODO Israel
+
+    // logs every mutation to <filepath>/database.wal, first replaying whatever an earlier run left there. What is read
+    // from files and checkpoints is logged too, so the replay doesn't depend on them. A record that is intact but
+    // can't be applied means the log doesn't match what it was written against, so that throws, naming the record,
+    // rather than opening with the records after it dropped
+    Database(const std::string &filepath, write_ahead_log::sync_policy policy) : Database(filepath)
+    {
+        auto log = std::make_unique<write_ahead_log>(filepath + "/database.wal", policy);
+        std::vector<std::string> records = log->recover();
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            try
+            {
+                replay(records[i]);
+            }
+            catch (const std::exception &e)
+            {
+                throw std::runtime_error("failed to replay record " + std::to_string(i) + " ('" + records[i].substr(0, 1) +
+                                         "') of " + filepath + "/database.wal: " + e.what());
+            }
+        }
+        wal = std::move(log);
+    }
+
+    ~Database()
+    {
+        wal.reset();
+        for (auto &c : collections)
+        {
+            std::filesystem::remove(temp_filepath + '/' + c.get_name() + ".bin.tmp");
+        }
+    }
+
+    const std::vector<std::string> get_collection_names()
+    {
+        std::shared_lock catalog(catalog_mutex);
+
+        std::vector<std::string> name_vector;
+        for (Collection &c : collections)
+        {
+
+            name_vector.emplace_back(c.get_name());
+        }
+
+        return name_vector;
+    } // possibly add caching, and return reference
+
+    void change_collection_name(const std::string &old_name, const std::string &new_name)
+    {
+        std::unique_lock catalog(catalog_mutex);
+
+        for (Collection &c : collections)
+        {
+            if (c.get_name() == new_name)
+            {
+                return;
+            }
+        }
+
+        for (Collection &c : collections)
         {
-            file << '"' << d.id << "\":" << d.data << ",\n";
+            if (c.get_name() == old_name)
+            {
+                if (std::filesystem::exists(cache_path(c)))
+                    std::filesystem::rename(cache_path(c), temp_filepath + '/' + new_name + ".bin.tmp");
+                c.change_name(new_name);
+                commit(log(wal_record('n').add(old_name).add(new_name)));
+            }
         }
-        file.seekp(file.tellp() - 2l);
-        file << "\n}";
-        file.close();
     }
 
-    void read(const std::string &filepath)
+    void set_current_collection(const std::string &name)
     {
-        std::ifstream file(filepath);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file: " + filepath);
-
-        std::string buffer, filedata;
-        std::getline(file, buffer);
-        if (buffer.size() == 0) // empty file
+        std::unique_lock catalog(catalog_mutex);
+        if (current_collection_set)
         {
-            file.close();
-            return;
+            if (current_collection->get_name() == name)
+            {
+                return;
+            }
         }
-        if (buffer[0] == '[') // data as array
+        for (auto c = collections.begin(); c != collections.end(); c++)
         {
-            do
+            if (c->get_name() == name)
             {
-                filedata += buffer;
+                // switched only once c is loaded, so a load that throws leaves the previous collection current;
+                // it's cached, if the budget needs, after the switch
+                evict_to_budget(&*c);
+                make_resident(*c);
+                current_collection_set = true;
+                current_collection = c;
+                evict_to_budget(&*c);
+                return;
             }
-            while (std::getline(file, buffer));
+        }
+        throw std::runtime_error("No collection with name");
+    }
+
+    // bytes of documents that collections other than the current one may keep in RAM; 0 keeps only the current one,
+    // otherwise the least recently used collections are cached to the temp directory when the total is over budget
+    void set_memory_budget(size_t bytes)
+    {
+        std::unique_lock catalog(catalog_mutex);
+        memory_budget = bytes;
+        evict_to_budget(nullptr);
+    }
+
+    std::vector<std::string> get_resident_collection_names()
+    {
+        std::shared_lock catalog(catalog_mutex);
+        std::vector<std::string> ret;
+        for (const Collection &c : collections)
+        {
+            if (c.resident)
+                ret.push_back(c.name);
+        }
+        return ret;
+    }
 
-            filedata = de_whitespace_json(filedata);
+    void add_collection(const std::string &name)
+    {
+        std::unique_lock catalog(catalog_mutex);
 
-            auto entries = tokenize_array(filedata);
-            for (const auto &entry : entries)
+        for (auto &c : collections)
+        {
+            if (c.get_name() == name)
             {
-                documents.emplace_back(entry);
+                throw std::runtime_error("name already exists");
             }
-            file.close();
-            return;
         }
+        if (current_collection_set && collections.size() == collections.capacity())
+        {
+            std::string cc_name = current_collection->get_name();
+            collections.emplace_back(name);
+            for (auto c = collections.begin(); c != collections.end(); c++)
+            {
+                if (c->get_name() == cc_name)
+                {
+                    current_collection = c;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            collections.emplace_back(name);
+        }
+        commit(log(wal_record('c').add(name)));
+    }
 
-        // data as undelimited objects
-        do
+    void remove_collection(const std::string name)
+    {
+        std::unique_lock catalog(catalog_mutex);
+        for (auto c = collections.begin(); c != collections.end(); c++)
         {
-            filedata += buffer;
-            size_t i = match_bracket(filedata, 0);
+            if (c->get_name() == name)
+            {
+                std::filesystem::remove(cache_path(*c));
+                if (current_collection_set && current_collection == c)
+                {
+                    current_collection_set = false;
+                }
+                else if (current_collection_set && current_collection > c)
+                {
+                    current_collection--;
+                }
+                collections.erase(c);
+                if (!current_collection_set)
+                    current_collection = collections.end();
+                commit(log(wal_record('x').add(name)));
+                return;
+            }
+        }
+        throw std::runtime_error("Collection does not exist");
+    }
 
-            if (i != std::string::npos)
+    void add_collection_from_file(const std::string& name, const std::string& filepath)
+    {
+        std::unique_lock catalog(catalog_mutex);
+        for(auto& c:collections)
+        {
+            if(c.get_name() == name)
             {
-                i++;
-                documents.emplace_back(filedata.substr(0, i));
-                filedata = filedata.substr(i);
+                throw std::runtime_error("Name already exists");
             }
         }
-        while(std::getline(file, buffer));
 
-        file.close();
+        if (current_collection_set && collections.size() == collections.capacity())
+        {
+            std::string cc_name = current_collection->get_name();
+            collections.emplace_back(name, filepath);
+            for (auto c = collections.begin(); c != collections.end(); c++)
+            {
+                if (c->get_name() == cc_name)
+                {
+                    current_collection = c;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            collections.emplace_back(name,filepath);
+        }
+        commit(log(wal_record('f').add(name).add(filepath)));
     }
 
-    void save(const std::string &filepath)
+    // sets whether documents in every collection are kept parsed; collections that aren't resident parse when loaded
+    void set_preparsed(bool enabled)
     {
-        std::ofstream file(filepath);
-        if (!file.is_open())
-            throw std::runtime_error("failed to open file: " + filepath);
-        file << "[\n";
-        if (documents.size() == 0)
+        std::unique_lock catalog(catalog_mutex);
+        for (auto &c : collections)
         {
-            file << ']';
-            file.close();
-            return;
+            if (c.resident)
+                c.set_preparsed(enabled);
+            else
+                c.preparsed = enabled;
         }
+    }
 
-        for (size_t i = 0; i < documents.size() - 1; i++)
+    // sets whether collections created from files are memory mapped when they're loaded
+    void set_memory_mapped(bool enabled)
+    {
+        std::unique_lock catalog(catalog_mutex);
+        for (auto &c : collections)
         {
-            file << '\t' << documents[i].data << ",\n";
+            c.set_memory_mapped(enabled);
         }
-        file << '\t' << documents.back().data << "\n]";
-
-        file.close();
     }
 
-    const std::string &get_name()
+    // sets the fraction of removed documents at which every collection compacts its storage
+    void set_compaction_threshold(double fraction)
     {
-        return name;
+        std::unique_lock catalog(catalog_mutex);
+        for (auto &c : collections)
+        {
+            c.set_compaction_threshold(fraction);
+        }
     }
 
-    void change_name(const std::string &new_name)
+    void save_current_collection(const std::string &filepath){
+        {
+            std::shared_lock catalog(catalog_mutex);
+            if(current_collection_set == false){
+                throw std::runtime_error("no current collection cannot save");
+            }
+            std::shared_lock lock(*current_collection->mutex);
+            current_collection->save(filepath);
+        }
+        std::unique_lock catalog(catalog_mutex);
+        rotate_log();
+    }
+    //add save all collections? would require collections to store filepath
+
+    void load_current_collection(const std::string &filepath)
     {
-        name = new_name;
-    } // TODO:
+        std::shared_lock catalog(catalog_mutex);
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection cannot load");
+        }
+        uint64_t lsn;
+        {
+            std::unique_lock lock(*current_collection->mutex);
+            size_t first = current_collection->documents.size();
+            current_collection->load(filepath);
+            lsn = log_contents(*current_collection, first, false, true);
+        }
+        commit(lsn);
+    }
 
-    // C
-    size_t add_document(const std::string &json)
+    // writes the current collection's changes since its last checkpoint as a new segment in directory
+    void checkpoint_current_collection(const std::string &directory)
     {
+        {
+            std::shared_lock catalog(catalog_mutex);
+            if(current_collection_set == false){
+                throw std::runtime_error("no current collection cannot checkpoint");
+            }
+            std::unique_lock lock(*current_collection->mutex);
+            current_collection->checkpoint(directory);
+        }
+        std::unique_lock catalog(catalog_mutex);
+        rotate_log();
+    }
 
-        documents.emplace_back(json);
-        return documents.back().get_id();
-    } // TODO:
+    void load_current_collection_checkpoint(const std::string &directory)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection cannot load");
+        }
+        uint64_t lsn;
+        {
+            std::unique_lock lock(*current_collection->mutex);
+            current_collection->load_checkpoint(directory);
+            lsn = log_contents(*current_collection, 0, true, false);
+        }
+        commit(lsn);
+    }
 
-    // R
-    const Document &get_document(size_t id)
+    void merge_current_collection_checkpoints(const std::string &directory)
     {
-        size_t left = 0;
-        size_t right = documents.size()-1;
-        size_t center;
-        size_t c_id;
-        while(true){
-            center = (right + left)/2;
-            c_id = documents[center].id;
-            if(left >= right){
-                if(c_id != id){
-                    throw std::runtime_error("Could not find document with id: " + std::to_string(id));
-                }
-            }
-            if(c_id == id){
-                return documents[center];
-            }
-            else if(c_id > id){
-                right = center - 1;  
-            }
-            else{
-                left = center + 1;
-            }
+        std::shared_lock catalog(catalog_mutex);
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection cannot merge checkpoints");
+        }
+        std::unique_lock lock(*current_collection->mutex);
+        current_collection->merge_checkpoints(directory);
+    }
 
+    std::vector<size_t>get_ids()
+    {
+        std::shared_lock catalog(catalog_mutex);
+        std::vector<size_t> ret;
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection could not get ids");
+        }
+        std::shared_lock lock(*current_collection->mutex);
+        for(const auto& d : *current_collection){
+            ret.push_back(d.get_id());
         }
+        return ret;
     }
 
-    const std::vector<Document> get_documents(const std::string &pattern, bool parallel)
+    // holds the current collection for reading, so references and iterators stay valid while it lives
+    struct read_guard
     {
-        // check if documents exist in collection
-        if (documents.size() == 0)
+        std::shared_lock<std::shared_mutex> catalog;
+        std::shared_lock<std::shared_mutex> collection;
+    };
+
+    read_guard read_lock() const
+    {
+        read_guard guard{std::shared_lock(catalog_mutex), {}};
+        if (current_collection_set)
+            guard.collection = std::shared_lock(*current_collection->mutex);
+        return guard;
+    }
+
+    // operations on a named collection that leave the current collection alone; the collection is loaded when
+    // needed and counts as used for the memory budget. Documents are returned as copies since it may be evicted
+    class collection_handle
+    {
+    public:
+        const std::string &get_name() const
         {
-            throw std::runtime_error("no documents exist in collection");
+            return name;
         }
 
-        auto [keys, vals] = tokenize_pattern(de_whitespace_json(pattern));
+        size_t add_document(const std::string &json)
+        {
+            uint64_t lsn;
+            size_t id = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                size_t id = c.add_document(json);
+                lsn = db->log(wal_record('a').add(name).add(id).add(json));
+                return id;
+            });
+            db->commit(lsn);
+            return id;
+        }
 
-        // Single threaded implementation
-        if (!parallel)
+        size_t add_document(size_t id, const std::string &json)
         {
-            std::vector<Document> result_vector;
-            // iterate through all documents in documents vector
-            for (Document &d : documents)
+            uint64_t lsn;
+            db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
             {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        if (d.query_as_string(keys.at(i)) != vals.at(i))
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == true)
-                {
-                    result_vector.emplace_back(d);
-                }
-            }
+                c.add_document(id, json);
+                lsn = db->log(wal_record('a').add(name).add(id).add(json));
+            });
+            db->commit(lsn);
+            return id;
+        }
 
-            // if document containing pattern is found, emplace_back into result vector
-            // return result vector
-            return result_vector;
+        size_t reserve_ids(size_t count)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.reserve_ids(count);
+            });
         }
 
+        std::pair<size_t, size_t> add_documents(std::vector<std::string> &&jsons)
+        {
+            uint64_t lsn;
+            auto ids = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                auto ids = c.add_documents(std::move(jsons));
+                lsn = db->log_batch(c, ids);
+                return ids;
+            });
+            db->commit(lsn);
+            return ids;
+        }
 
-        // Parallel implementation
-        
-        int num_threads = omp_get_num_procs();
-        std::vector<std::vector<Document>> result_vector(num_threads);
-        
-        for(auto& v : result_vector)
+        std::pair<size_t, size_t> add_documents_from_buffer(std::string_view buffer)
         {
-            v.reserve(documents.size() / num_threads + 1);
+            uint64_t lsn;
+            auto ids = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                auto ids = c.add_documents_from_buffer(buffer);
+                lsn = db->log_batch(c, ids);
+                return ids;
+            });
+            db->commit(lsn);
+            return ids;
         }
 
-        #pragma omp parallel shared(documents) shared(result_vector)
+        Document get_document(size_t id)
         {
-            int id = omp_get_thread_num();
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.get_document(id);
+            });
+        }
 
-            #pragma omp for 
-            for (Document &d : documents)
+        std::vector<Document> get_documents(const std::string &pattern, bool parallel = true)
+        {
+            return get_documents(Filter(pattern), parallel);
+        }
+
+        std::vector<Document> get_documents(const Filter &filter, bool parallel = true)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
             {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        if (d.query_as_string(keys.at(i)) != vals.at(i))
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == true)
+                return c.get_documents(filter, parallel);
+            });
+        }
+
+        std::vector<projected_row> get_documents(const std::string &pattern, const Projection &projection, bool parallel = true)
+        {
+            return get_documents(Filter(pattern), projection, parallel);
+        }
+
+        std::vector<projected_row> get_documents(const Filter &filter, const Projection &projection, bool parallel = true)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.get_documents(filter, projection, parallel);
+            });
+        }
+
+        size_t count_documents(const std::string &pattern, bool parallel = true)
+        {
+            return count_documents(Filter(pattern), parallel);
+        }
+
+        size_t count_documents(const Filter &filter, bool parallel = true)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.count_documents(filter, parallel);
+            });
+        }
+
+        aggregate_result aggregate(const std::string &pattern, const std::string &path, bool parallel = true)
+        {
+            return aggregate(Filter(pattern), path, parallel);
+        }
+
+        aggregate_result aggregate(const Filter &filter, const std::string &path, bool parallel = true)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.aggregate(filter, path, parallel);
+            });
+        }
+
+        aggregate_groups aggregate_by(const std::string &pattern, const std::string &path, const std::string &group_by, bool parallel = true)
+        {
+            return aggregate_by(Filter(pattern), path, group_by, parallel);
+        }
+
+        aggregate_groups aggregate_by(const Filter &filter, const std::string &path, const std::string &group_by, bool parallel = true)
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                return c.aggregate_by(filter, path, group_by, parallel);
+            });
+        }
+
+        std::vector<size_t> get_ids()
+        {
+            return db->with_collection<std::shared_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                std::vector<size_t> ret;
+                for (const Document &d : c)
                 {
-                    result_vector[id].push_back(d);
+                    ret.push_back(d.get_id());
                 }
-            }
+                return ret;
+            });
         }
 
-        for(size_t i = 1; i < result_vector.size(); i++)
+        void update_document(size_t id, const std::string &data)
         {
-            result_vector[0].reserve(result_vector[i].size() + result_vector[0].size());
-            std::move(result_vector[i].begin(), result_vector[i].end(), std::back_inserter(result_vector[0]));
+            uint64_t lsn = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                c.update_document(id, data);
+                return db->log(wal_record('u').add(name).add(id).add(data));
+            });
+            db->commit(lsn);
         }
 
-        // if document containing pattern is found, emplace_back into result vector
-        // return result vector
-        result_vector[0].shrink_to_fit();
-        return result_vector[0];
-    }
+        void update_documents(const std::string &pattern, const std::string &data, bool parallel = true)
+        {
+            update_documents(Filter(pattern), data, parallel);
+        }
 
-    // U
-    void update_document(size_t id, const std::string &data)
-    {
-        std::function<void(std::string &, const std::string &)> replace_array_field;
+        void update_documents(const Filter &filter, const std::string &data, bool parallel = true)
+        {
+            uint64_t lsn = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                c.update_documents(filter, data, parallel);
+                return db->log(wal_record('U').add(name).add(filter.get_pattern()).add(data));
+            });
+            db->commit(lsn);
+        }
 
-        std::function<void(std::string &, const std::string &)> replace_object_field = [&](std::string &old_data, const std::string &new_data)
+        void remove_document(size_t id)
         {
-            auto fields = tokenize_json(old_data);
-            auto new_fields = tokenize_json(new_data);
-            bool replaced = false;
-            for (size_t i = 0; i < new_fields.size(); i += 2)
+            uint64_t lsn = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
             {
-                for (size_t j = 0; j < fields.size(); j += 2)
-                {
-                    if (new_fields[i] == fields[j])
-                    {
-                        switch (new_fields[i + 1][0])
-                        {
-                        case '{':
-                            replace_object_field(fields[j + 1], new_fields[i + 1]);
-                            break;
-                        case '[':
-                            replace_array_field(fields[j + 1], new_fields[i + 1]);
-                            break;
-                        default:
-                            if (new_fields[i + 1] == "delete")
-                            {
-                                fields.erase(fields.begin() + j, fields.begin() + j + 2);
-                                j--;
-                                replaced = true;
-                                continue;
-                            }
-                            else
-                            {
-                                fields[j + 1] = new_fields[i + 1];
-                                replaced = true;
-                                continue;
-                            }
-                        }
-                    }
-                }
-                if (!replaced)
-                {
-                    fields.push_back(new_fields[i]);
-                    fields.push_back(new_fields[i + 1]);
-                }
-            }
-            old_data = smash_json(fields);
-        };
+                c.remove_document(id);
+                return db->log(wal_record('d').add(name).add(id));
+            });
+            db->commit(lsn);
+        }
 
-        replace_array_field = [&](std::string &old_data, const std::string &new_data)
+        void remove_documents(const std::string &pattern, bool parallel = true)
         {
-            auto fields = tokenize_array(old_data);
-            size_t back = new_data.find(':'); // not robust, needs check for formatting correctness
-            size_t index = std::stoi(new_data.substr(1, back));
-            auto val = new_data.substr(back + 1, new_data.size() - back - 2);
+            remove_documents(Filter(pattern), parallel);
+        }
 
-            switch (val[0])
+        void remove_documents(const Filter &filter, bool parallel = true)
+        {
+            uint64_t lsn = db->with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
             {
-            case '{':
-                replace_object_field(old_data, new_data);
-                break;
-            case '[':
-                replace_array_field(old_data, new_data);
-                break;
-            default:
-                fields[index] = val;
-            }
+                c.remove_documents(filter, parallel);
+                return db->log(wal_record('D').add(name).add(filter.get_pattern()));
+            });
+            db->commit(lsn);
+        }
 
-            old_data = smash_array(fields);
-        };
+    private:
+        collection_handle(Database *db, const std::string &name) : db(db), name(name)
+        {
+        }
 
-        auto formatted_data = de_whitespace_json(data);
-        auto failure  = verify_json(formatted_data);
-        if (failure) throw std::runtime_error(*failure);
+        Database *db;
+        std::string name;
+        friend class Database;
+    };
 
-        size_t left = 0;
-        size_t right = documents.size()-1;
-        size_t center;
-        size_t c_id;
-        while(true){
-            center = (right + left)/2;
-            c_id = documents[center].id;
-            if(left >= right){
-                if(c_id != id){
-                    throw std::runtime_error("Could not find document with id: " + std::to_string(id));
-                }
-            }
-            if(c_id == id){
-                replace_object_field(documents[center].data,formatted_data);
-                return;
-            }
-            else if(c_id > id){
-                right = center - 1;  
-            }
-            else{
-                left = center + 1;
-            }
+    collection_handle get_collection(const std::string &name)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        find_collection(name);
+        return collection_handle(this, name);
+    }
 
+    // not locked; hold a read_lock while iterating if other threads write
+    document_iterator begin() const
+    {
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection");
         }
+        return current_collection->begin();
     }
 
-    void update_documents(const std::string &pattern, const std::string &data, bool parallel)
+    document_iterator end() const
     {
-
-        // check if documents exist in collection
-        if (documents.size() == 0)
-        {
-            throw std::runtime_error("no documents exist in collection");
+        if(current_collection_set == false){
+            throw std::runtime_error("no current collection");
         }
+        return current_collection->end();
+    }
 
-        auto [keys, vals] = tokenize_pattern(de_whitespace_json(pattern));
-
-
-        if (!parallel)
+    // top level copies of CRUD operations for direct user interface
+    // C
+    size_t add_document(const std::string &json)
+    {
+        size_t id;
+        uint64_t lsn;
         {
-            // iterate through all documents in documents vector
-            for (Document &d : documents)
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
             {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        std::string v = d.query_as_string(keys.at(i));
-                        std::string e = vals.at(i);
-                        if (v != e)
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == true)
-                {
-                    update_document(d.id, data);
-                }
+                throw std::runtime_error("No collections");
             }
-            return;
-        }
-
-
-        // iterate through all documents in documents vector
-        #pragma omp parallel shared(documents) shared(keys) shared(vals)
-        {   
-            #pragma omp for
-            for (Document &d : documents)
+            if (current_collection_set == false)
             {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        std::string v = d.query_as_string(keys.at(i));
-                        std::string e = vals.at(i);
-                        if (v != e)
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == true)
-                {
-                    update_document(d.id, data);
-                }
+                throw std::runtime_error("No current collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
+
+            id = current_collection->add_document(json);
+            lsn = log(wal_record('a').add(current_collection->name).add(id).add(json));
         }
+        commit(lsn);
+        return id;
     }
 
-    // D
-    void remove_document(size_t id)
+    // adds with an id from reserve_ids
+    size_t add_document(size_t id, const std::string &json)
     {
-        size_t left = 0;
-        size_t right = documents.size()-1;
-        size_t center;
-        size_t c_id;
-        while(true){
-            center = (right + left)/2;
-            c_id = documents[center].id;
-            if(left >= right){
-                if(c_id != id){
-                    throw std::runtime_error("Could not find document with id: " + std::to_string(id));
-                }
-            }
-            if(c_id == id){
-                documents.erase(documents.begin()+center);
-                return;
-            }
-            else if(c_id > id){
-                right = center - 1;  
-            }
-            else{
-                left = center + 1;
+        uint64_t lsn;
+        {
+            std::shared_lock catalog(catalog_mutex);
+            if (current_collection_set == false)
+            {
+                throw std::runtime_error("No current collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
 
+            current_collection->add_document(id, json);
+            lsn = log(wal_record('a').add(current_collection->name).add(id).add(json));
         }
+        commit(lsn);
+        return id;
     }
 
-    void remove_documents(const std::string &pattern, bool parallel)
+    // claims a block of count ids in the current collection and returns the first
+    size_t reserve_ids(size_t count)
     {
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("No current collection");
+        }
+        return current_collection->reserve_ids(count);
+    }
 
-        // check if documents exist in collection
-        if (documents.size() == 0)
+    // adds a batch to the current collection, returning its contiguous id range [first, last)
+    std::pair<size_t, size_t> add_documents(std::vector<std::string> &&jsons)
+    {
+        return add_batch([&](Collection &c) { return c.add_documents(std::move(jsons)); });
+    }
+
+    std::pair<size_t, size_t> add_documents_from_buffer(std::string_view buffer)
+    {
+        return add_batch([&](Collection &c) { return c.add_documents_from_buffer(buffer); });
+    }
+
+    // R
+    // for a thread holding guard, which already holds the locks the overload above would take again; taking a
+    // shared lock twice from one thread is undefined and can deadlock behind a waiting writer. The reference stays
+    // valid while guard lives
+    const Document &get_document(const read_guard &guard, size_t id)
+    {
+        if (!guard.collection.owns_lock())
         {
-            throw std::runtime_error("no documents exist in collection");
+            throw std::runtime_error("no active collection");
         }
+        return current_collection->get_document(id);
+    }
 
-        auto [keys, vals] = tokenize_pattern(de_whitespace_json(pattern));
+    const Document &get_document(size_t id)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        // calls the analogous function call in the collection and returns the result of that
 
-        if (!parallel)
-        { 
-            // iterate through all documents in documents vector
-            for (Document &d : documents)
-            {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        std::string v = d.query_as_string(keys.at(i));
-                        std::string e = vals.at(i);
-                        if (v != e)
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == true)
-                {
-                    remove_document(d.id);
-                }
-            }
-            return;
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("no active collection");
         }
+        std::shared_lock lock(*current_collection->mutex);
+        return current_collection->get_document(id);
+    }
 
+    const std::vector<Document> get_documents(const std::string &pattern, bool parallel = true)
+    {
+        return get_documents(Filter(pattern), parallel);
+    }
 
-        // iterate through all documents in documents vector
-        int num_threads = omp_get_num_procs();
-        std::vector<std::vector<Document>> result_vector(num_threads);
+    const std::vector<Document> get_documents(const Filter &filter, bool parallel = true)
+    { // faheds
+        std::shared_lock catalog(catalog_mutex);
 
-        for(auto& v : result_vector)
+        if (collections.size() == 0)
         {
-            v.reserve(documents.size() / num_threads + 1);
+            throw std::runtime_error("No collections");
         }
-
-        #pragma omp parallel shared(documents) shared(result_vector)
+        if (current_collection_set == false)
         {
-            int id = omp_get_thread_num();
-            
-            #pragma omp for
-            for (Document &d : documents)
-            {
-                bool match = true;
-                for (size_t i = 0; i < keys.size(); i++)
-                {
-                    try // This is bad. We need to replace it with a call to verify keys
-                    {
-                        std::string v = d.query_as_string(keys.at(i));
-                        std::string e = vals.at(i);
-                        if (v != e)
-                        {
-                            match = false;
-                            break;
-                        }
-                    }
-                    catch(...)
-                    {
-                        match = false;
-                        break;
-                    }
-                }
-                if (match == false)
-                {
-                    result_vector[id].emplace_back(d);
-                }
-            }
+            throw std::runtime_error("No current collection");
         }
+        std::shared_lock lock(*current_collection->mutex);
 
-        for(size_t i = 1; i < result_vector.size(); i++)
+        return current_collection->get_documents(filter, parallel);
+    }
+
+    std::vector<projected_row> get_documents(const std::string &pattern, const Projection &projection, bool parallel = true)
+    {
+        return get_documents(Filter(pattern), projection, parallel);
+    }
+
+    std::vector<projected_row> get_documents(const Filter &filter, const Projection &projection, bool parallel = true)
+    {
+        std::shared_lock catalog(catalog_mutex);
+
+        if (collections.size() == 0)
         {
-            result_vector[0].reserve(result_vector[i].size() + result_vector[0].size());
-            std::move(result_vector[i].begin(), result_vector[i].end(), std::back_inserter(result_vector[0]));
+            throw std::runtime_error("No collections");
         }
-        
-        result_vector[0].shrink_to_fit();
-        documents = result_vector[0];
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("No current collection");
+        }
+        std::shared_lock lock(*current_collection->mutex);
+
+        return current_collection->get_documents(filter, projection, parallel);
     }
 
-private:
-    std::string name;
-    std::vector<Document> documents;
-    friend class Database;
-    void clear_from_ram() { documents.clear(); }
-    std::string cache_file;
-    std::string load_file;
-};
+    // aggregates run inside the scan with a partial result per thread, so no documents are copied
+    size_t count_documents(const std::string &pattern, bool parallel = true)
+    {
+        return count_documents(Filter(pattern), parallel);
+    }
 
-class Database
-{
-public:
-    Database(const std::string &filepath)
+    size_t count_documents(const Filter &filter, bool parallel = true)
     {
-        current_collection = collections.end();
-        current_collection_set = false;
-        temp_filepath = filepath;
-        if (!std::filesystem::exists(filepath))
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
         {
-            throw std::runtime_error("filepath: " + filepath + " does not exist");
+            throw std::runtime_error("No current collection");
         }
-    } // TODO Israel
+        std::shared_lock lock(*current_collection->mutex);
+        return current_collection->count_documents(filter, parallel);
+    }
 
-    ~Database()
+    aggregate_result aggregate(const std::string &pattern, const std::string &path, bool parallel = true)
     {
-        for (auto &c : collections)
+        return aggregate(Filter(pattern), path, parallel);
+    }
+
+    aggregate_result aggregate(const Filter &filter, const std::string &path, bool parallel = true)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
         {
-            std::filesystem::remove(temp_filepath + '/' + c.get_name() + ".json.tmp");
+            throw std::runtime_error("No current collection");
         }
+        std::shared_lock lock(*current_collection->mutex);
+        return current_collection->aggregate(filter, path, parallel);
     }
 
-    const std::vector<std::string> get_collection_names()
+    aggregate_groups aggregate_by(const std::string &pattern, const std::string &path, const std::string &group_by, bool parallel = true)
     {
+        return aggregate_by(Filter(pattern), path, group_by, parallel);
+    }
 
-        std::vector<std::string> name_vector;
-        for (Collection &c : collections)
+    aggregate_groups aggregate_by(const Filter &filter, const std::string &path, const std::string &group_by, bool parallel = true)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
         {
-
-            name_vector.emplace_back(c.get_name());
+            throw std::runtime_error("No current collection");
         }
+        std::shared_lock lock(*current_collection->mutex);
+        return current_collection->aggregate_by(filter, path, group_by, parallel);
+    }
 
-        return name_vector;
-    } // possibly add caching, and return reference
+    // does not copy; the pointers are valid until the current collection is changed or modified, which other threads
+    // may do as soon as this returns. Use the guard overloads below when they might
+    std::vector<const Document *> get_document_refs(const std::string &pattern, bool parallel = true)
+    {
+        return get_document_refs(Filter(pattern), parallel);
+    }
 
-    void change_collection_name(const std::string &old_name, const std::string &new_name)
+    // for a thread holding guard, taking no locks of its own as with get_document(guard, id); the pointers stay valid
+    // while guard lives
+    std::vector<const Document *> get_document_refs(const read_guard &guard, const std::string &pattern, bool parallel = true)
     {
+        return get_document_refs(guard, Filter(pattern), parallel);
+    }
 
-        for (Collection &c : collections)
+    std::vector<const Document *> get_document_refs(const read_guard &guard, const Filter &filter, bool parallel = true)
+    {
+        if (!guard.collection.owns_lock())
         {
-            if (c.get_name() == new_name)
-            {
-                return;
-            }
+            throw std::runtime_error("No current collection");
         }
+        return current_collection->get_document_refs(filter, parallel);
+    }
 
-        for (Collection &c : collections)
+    std::vector<const Document *> get_document_refs(const Filter &filter, bool parallel = true)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        if (collections.size() == 0)
         {
-            if (c.get_name() == old_name)
-            {
-                c.change_name(new_name);
-            }
+            throw std::runtime_error("No collections");
         }
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("No current collection");
+        }
+        std::shared_lock lock(*current_collection->mutex);
+
+        return current_collection->get_document_refs(filter, parallel);
     }
 
-    void set_current_collection(const std::string &name)
+    // U
+    void update_document(size_t id, const std::string &data)
     {
-        if (current_collection_set)
+        uint64_t lsn;
         {
-            if (current_collection->get_name() == name)
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
             {
-                return;
+                throw std::runtime_error("No collections");
             }
-        }
-        for (auto c = collections.begin(); c != collections.end(); c++)
-        {
-            if (c->get_name() == name)
+            if (current_collection_set == false)
             {
-                if (current_collection_set)
-                {
-                    current_collection->cache(temp_filepath + '/' + current_collection->get_name() + ".json.tmp");
-                    current_collection->clear_from_ram();
-                }
-                current_collection_set = true;
-                current_collection = c;
-                if(c->load_file.empty())
-                {
-                    if (std::filesystem::exists(temp_filepath + '/' + c->get_name() + ".json.tmp"))
-                        current_collection->load(temp_filepath + '/' + c->get_name() + ".json.tmp");
-                }
-                else
-                {
-                    if (std::filesystem::exists(c->load_file))
-                        current_collection->read(c->load_file);
-                    c->load_file = "";
-                }
-                return;
+                throw std::runtime_error("no active collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
+
+            current_collection->update_document(id, data);
+            lsn = log(wal_record('u').add(current_collection->name).add(id).add(data));
         }
-        throw std::runtime_error("No collection with name");
+        commit(lsn);
     }
 
-    void add_collection(const std::string &name)
+    void update_documents(const std::string &pattern, const std::string &data, bool parallel = true)
     {
+        update_documents(Filter(pattern), data, parallel);
+    }
 
-        for (auto &c : collections)
+    void update_documents(const Filter &filter, const std::string &data, bool parallel = true)
+    { // fahed
+        uint64_t lsn;
         {
-            if (c.get_name() == name)
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
             {
-                throw std::runtime_error("name already exists");
+                throw std::runtime_error("No collections");
             }
-        }
-        if (current_collection_set && collections.size() == collections.capacity())
-        {
-            std::string cc_name = current_collection->get_name();
-            collections.emplace_back(name);
-            for (auto c = collections.begin(); c != collections.end(); c++)
+            if (current_collection_set == false)
             {
-                if (c->get_name() == cc_name)
-                {
-                    current_collection = c;
-                    return;
-                }
+                throw std::runtime_error("No current collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
+
+            current_collection->update_documents(filter, data, parallel);
+            lsn = log(wal_record('U').add(current_collection->name).add(filter.get_pattern()).add(data));
         }
-        collections.emplace_back(name);
+        commit(lsn);
     }
 
-    void remove_collection(const std::string name)
+    // D
+    void remove_document(size_t id)
     {
-        for (auto c = collections.begin(); c != collections.end(); c++)
+        uint64_t lsn;
         {
-            if (c->get_name() == name)
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
             {
-                collections.erase(c);
-                if (current_collection > c)
-                {
-                    current_collection--;
-                }
+                throw std::runtime_error("No collections");
+            }
+            if (current_collection_set == false)
+            {
+                throw std::runtime_error("No current collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
+
+            current_collection->remove_document(id);
+            lsn = log(wal_record('d').add(current_collection->name).add(id));
         }
-        throw std::runtime_error("Collection does not exist");
+        commit(lsn);
     }
 
-    void add_collection_from_file(const std::string& name, const std::string& filepath)
+    void remove_documents(const std::string &pattern, bool parallel = true)
     {
-        for(auto& c:collections)
+        remove_documents(Filter(pattern), parallel);
+    }
+
+    void remove_documents(const Filter &filter, bool parallel = true)
+    {
+        uint64_t lsn;
         {
-            if(c.get_name() == name)
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
             {
-                throw std::runtime_error("Name already exists");
+                throw std::runtime_error("No collections");
             }
-        }
-
-        if (current_collection_set && collections.size() == collections.capacity())
-        {
-            std::string cc_name = current_collection->get_name();
-            collections.emplace_back(name);
-            for (auto c = collections.begin(); c != collections.end(); c++)
+            if (current_collection_set == false)
             {
-                if (c->get_name() == cc_name)
-                {
-                    current_collection = c;
-                    return;
-                }
+                throw std::runtime_error("No current collection");
             }
+            std::unique_lock lock(*current_collection->mutex);
+
+            current_collection->remove_documents(filter, parallel);
+            lsn = log(wal_record('D').add(current_collection->name).add(filter.get_pattern()));
         }
-        collections.emplace_back(name,filepath);
+        commit(lsn);
     }
 
-    void save_current_collection(const std::string &filepath){
-        if(current_collection_set == false){
-            throw std::runtime_error("no current collection cannot save");
+    // indexes are kept with the collection and rebuilt when it is loaded again
+    void create_index(const std::string &path)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("No current collection");
         }
-        current_collection->save(filepath);
+        std::unique_lock lock(*current_collection->mutex);
+
+        current_collection->create_index(path);
     }
-    //add save all collections? would require collections to store filepath
 
-    void load_current_collection(const std::string &filepath)
+    void drop_index(const std::string &path)
     {
-        if(current_collection_set == false){
-            throw std::runtime_error("no current collection cannot load");
+        std::shared_lock catalog(catalog_mutex);
+        if (current_collection_set == false)
+        {
+            throw std::runtime_error("No current collection");
         }
-        current_collection->load(filepath);
+        std::unique_lock lock(*current_collection->mutex);
+
+        current_collection->drop_index(path);
     }
 
-    std::vector<size_t>get_ids()
+private:
+    std::string temp_filepath;
+    std::vector<Collection> collections;
+    std::vector<Collection>::iterator current_collection; // change to pointer? same syntax mostly
+    bool current_collection_set;
+    size_t memory_budget = 0;
+    std::atomic<uint64_t> use_clock = 0;
+    std::unique_ptr<write_ahead_log> wal; // null unless constructed with a sync policy
+    static constexpr size_t contents_record_bytes = 1 << 24;
+    // shared by every document operation, exclusive for changes to the collection list or current collection
+    mutable std::shared_mutex catalog_mutex;
+
+    // appends a mutation to the log once it has been applied, returning the sequence number to commit
+    uint64_t log(const wal_record &record)
     {
-        std::vector<size_t> ret;
-        if(current_collection_set == false){
-            throw std::runtime_error("no current collection could not get ids");
-        }
-        for(const auto& d : current_collection->documents){
-            ret.push_back(d.get_id());
-        }
-        return ret;
+        if (!wal)
+            return 0;
+        return wal->append(record);
     }
 
-    std::vector<Document>::const_iterator begin() const
+    // called after the collection lock is released so writers waiting on the same fsync don't hold it
+    void commit(uint64_t lsn)
     {
-        if(current_collection_set == false){
-            throw std::runtime_error("no current collection");
-        }
-        return current_collection->documents.cbegin();
+        if (wal && lsn != 0)
+            wal->commit(lsn);
     }
 
-    std::vector<Document>::const_iterator end() const
+    // logs documents[first...] of c with their ids and stored json, so the replay doesn't depend on the file or
+    // segments they came from still holding them
+    uint64_t log_contents(const Collection &c, size_t first, bool replace, bool loaded)
     {
-        if(current_collection_set == false){
-            throw std::runtime_error("no current collection");
+        if (!wal)
+            return 0;
+        std::vector<wal_record> records;
+        contents_records(c, first, replace, loaded, records);
+        uint64_t lsn = 0;
+        for (const wal_record &record : records)
+        {
+            lsn = log(record);
         }
-        return current_collection->documents.cend();
+        return lsn;
     }
 
-    // top level copies of CRUD operations for direct user interface
-    // C
-    size_t add_document(const std::string &json)
+    // 'B' records for documents[first...] of c, of about contents_record_bytes each; the first carries replace
+    void contents_records(const Collection &c, size_t first, bool replace, bool loaded, std::vector<wal_record> &out)
     {
-        if (collections.size() == 0)
+        size_t begin = first;
+        do
         {
-            throw std::runtime_error("No collections");
-        }
-        if (current_collection_set == false)
+            size_t end = begin, count = 0, bytes = 0;
+            while (end < c.documents.size() && bytes < contents_record_bytes)
+            {
+                if (!c.documents[end].tombstone)
+                {
+                    count++;
+                    bytes += c.documents[end].json().size();
+                }
+                end++;
+            }
+
+            wal_record record('B');
+            record.add(c.name).add(replace).add(loaded).add(c.next_id->load()).add(count);
+            for (size_t i = begin; i < end; i++)
+            {
+                if (!c.documents[i].tombstone)
+                    record.add(c.documents[i].id).add(c.documents[i].json());
+            }
+            out.push_back(std::move(record));
+            replace = false;
+            begin = end;
+        } while (begin < c.documents.size());
+    }
+
+    // replaces the log with a snapshot of the collections, dropping the records of every change that led to them,
+    // once it has grown enough to be worth it. Collections whose file hasn't been read yet are logged as from the
+    // file; the rest by their documents and what their next checkpoint has to write. Needs the catalog exclusively,
+    // so nothing is logged meanwhile
+    void rotate_log()
+    {
+        if (!wal || !wal->should_rewrite())
+            return;
+        std::vector<wal_record> records;
+        for (const Collection &c : collections)
         {
-            throw std::runtime_error("No current collection");
+            if (!c.resident && !c.load_file.empty())
+            {
+                records.push_back(wal_record('f').add(c.name).add(c.load_file));
+                continue;
+            }
+
+            records.push_back(wal_record('c').add(c.name));
+            if (c.resident)
+            {
+                contents_records(c, 0, false, false, records);
+            }
+            else
+            {
+                Collection cached(c.name);
+                if (std::filesystem::exists(cache_path(c)))
+                    cached.load_binary(cache_path(c));
+                cached.next_id->store(c.next_id->load());
+                contents_records(cached, 0, false, false, records);
+            }
+
+            wal_record pending('p');
+            pending.add(c.name).add(c.dirty.size());
+            for (size_t id : c.dirty)
+            {
+                pending.add(id);
+            }
+            pending.add(c.removed.size());
+            for (size_t id : c.removed)
+            {
+                pending.add(id);
+            }
+            records.push_back(std::move(pending));
         }
+        wal->rewrite(records);
+    }
 
-        return current_collection->add_document(json);
+    // logs a batch just added to c as one record holding the stored (minified) json of each document
+    uint64_t log_batch(const Collection &c, std::pair<size_t, size_t> ids)
+    {
+        if (!wal)
+            return 0;
+        size_t count = ids.second - ids.first;
+        wal_record record('A');
+        record.add(c.name).add(ids.first).add(count);
+        for (size_t i = c.documents.size() - count; i < c.documents.size(); i++)
+            record.add(c.documents[i].json());
+        return log(record);
     }
 
-    // R
-    const Document &get_document(size_t id)
+    template <typename Add>
+    std::pair<size_t, size_t> add_batch(Add add)
     {
+        std::pair<size_t, size_t> ids;
+        uint64_t lsn;
+        {
+            std::shared_lock catalog(catalog_mutex);
+            if (collections.size() == 0)
+            {
+                throw std::runtime_error("No collections");
+            }
+            if (current_collection_set == false)
+            {
+                throw std::runtime_error("No current collection");
+            }
+            std::unique_lock lock(*current_collection->mutex);
 
-        // calls the analogous function call in the collection and returns the result of that
+            ids = add(*current_collection);
+            lsn = log_batch(*current_collection, ids);
+        }
+        commit(lsn);
+        return ids;
+    }
 
-        if (current_collection_set == false)
+    // applies a logged mutation; runs before wal is set, so nothing is logged again
+    void replay(const std::string &record)
+    {
+        wal_reader reader(record);
+        switch (reader.op())
         {
-            throw std::runtime_error("no active collection");
-        }
-        try
+        case 'c':
+            add_collection(reader.next_string());
+            break;
+        case 'f':
         {
-            return current_collection->get_document(id);
+            std::string name = reader.next_string();
+            std::string filepath = reader.next_string();
+            if (std::filesystem::exists(filepath))
+            {
+                add_collection_from_file(name, filepath);
+            }
+            else
+            {
+                // it's gone since, which only matters if it wasn't read before; then it loads empty as it would have
+                collections.emplace_back(name);
+                collections.back().load_file = filepath;
+            }
+            break;
         }
-        catch (std::runtime_error &e)
+        case 'x':
+            remove_collection(reader.next_string());
+            break;
+        case 'n':
         {
-            throw e;
+            std::string old_name = reader.next_string();
+            change_collection_name(old_name, reader.next_string());
+            break;
         }
-    }
-
-    const std::vector<Document> get_documents(const std::string &pattern, bool parallel = true)
-    { // faheds
-
-        if (collections.size() == 0)
+        case 'B':
         {
-            throw std::runtime_error("No collections");
+            std::string name = reader.next_string();
+            bool replace = reader.next_u64();
+            bool loaded = reader.next_u64();
+            size_t next = reader.next_u64();
+            std::vector<std::pair<size_t, std::string>> records(reader.next_u64());
+            for (auto &[id, json] : records)
+            {
+                id = reader.next_u64();
+                json = reader.next_string();
+            }
+            Collection &c = find_collection(name);
+            if (!c.load_file.empty())
+            {
+                // these are what was read from the file, so it isn't read again
+                c.load_file = "";
+                c.resident = true;
+            }
+            with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                c.restore_documents(records, replace, loaded, next);
+            });
+            break;
         }
-        if (current_collection_set == false)
+        case 'p':
         {
-            throw std::runtime_error("No current collection");
+            std::string name = reader.next_string();
+            std::set<size_t> dirty, removed;
+            for (size_t i = reader.next_u64(); i > 0; i--)
+            {
+                dirty.insert(reader.next_u64());
+            }
+            for (size_t i = reader.next_u64(); i > 0; i--)
+            {
+                removed.insert(reader.next_u64());
+            }
+            Collection &c = find_collection(name);
+            c.dirty = std::move(dirty);
+            c.removed = std::move(removed);
+            break;
         }
-
-        return current_collection->get_documents(pattern, parallel);
-    }
-
-    // U
-    void update_document(size_t id, const std::string &data)
-    {
-        if (collections.size() == 0)
+        case 'a':
         {
-            throw std::runtime_error("No collections");
+            std::string name = reader.next_string();
+            size_t id = reader.next_u64();
+            std::string json = reader.next_string();
+            with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                c.add_document(id, json);
+            });
+            break;
         }
-        if (current_collection_set == false)
+        case 'A':
         {
-            throw std::runtime_error("no active collection");
+            std::string name = reader.next_string();
+            size_t first = reader.next_u64();
+            size_t count = reader.next_u64();
+            with_collection<std::unique_lock<std::shared_mutex>>(name, [&](Collection &c)
+            {
+                for (size_t i = 0; i < count; i++)
+                    c.add_document(first + i, reader.next_string());
+            });
+            break;
         }
-
-        try
+        case 'u':
         {
-            return current_collection->update_document(id, data);
+            std::string name = reader.next_string();
+            size_t id = reader.next_u64();
+            get_collection(name).update_document(id, reader.next_string());
+            break;
         }
-        catch (std::runtime_error &e)
+        case 'U':
         {
-            throw e;
+            std::string name = reader.next_string();
+            std::string pattern = reader.next_string();
+            get_collection(name).update_documents(pattern, reader.next_string());
+            break;
         }
-    }
-
-    void update_documents(const std::string &pattern, const std::string &data, bool parallel = true)
-    { // fahed
-
-        if (collections.size() == 0)
+        case 'd':
         {
-            throw std::runtime_error("No collections");
+            std::string name = reader.next_string();
+            get_collection(name).remove_document(reader.next_u64());
+            break;
         }
-        if (current_collection_set == false)
+        case 'D':
         {
-            throw std::runtime_error("No current collection");
+            std::string name = reader.next_string();
+            get_collection(name).remove_documents(reader.next_string());
+            break;
+        }
+        default:
+            throw std::runtime_error("malformed log record");
         }
+    }
 
-        current_collection->update_documents(pattern, data, parallel);
+    std::string cache_path(const Collection &c) const
+    {
+        return temp_filepath + '/' + c.name + ".bin.tmp";
     }
 
-    // D
-    void remove_document(size_t id)
+    Collection &find_collection(const std::string &name)
     {
-        if (collections.size() == 0)
-        {
-            throw std::runtime_error("No collections");
-        }
-        if (current_collection_set == false)
+        for (Collection &c : collections)
         {
-            throw std::runtime_error("No current collection");
+            if (c.name == name)
+                return c;
         }
-        try
+        throw std::runtime_error("No collection with name");
+    }
+
+    // loads a collection from its file or the temp cache; needs the catalog exclusively
+    void make_resident(Collection &c)
+    {
+        c.last_used->store(++use_clock);
+        if (c.resident)
+            return;
+
+        if (c.load_file.empty())
         {
-            current_collection->remove_document(id);
+            if (std::filesystem::exists(cache_path(c)))
+                c.load_binary(cache_path(c));
         }
-        catch (std::runtime_error &e)
+        else
         {
-            throw e;
+            // the file may change before the log is replayed, so what was read from it is logged
+            size_t first = c.documents.size();
+            if (std::filesystem::exists(c.load_file))
+                c.read(c.load_file);
+            c.load_file = "";
+            log_contents(c, first, false, true);
         }
+        c.resident = true;
     }
 
-    void remove_documents(const std::string &pattern, bool parallel = true)
+    // caches least recently used collections, never the current one or keep, until the rest fit the budget;
+    // needs the catalog exclusively
+    void evict_to_budget(const Collection *keep)
     {
-
-        if (collections.size() == 0)
+        std::vector<Collection *> candidates;
+        size_t used = 0;
+        for (Collection &c : collections)
         {
-            throw std::runtime_error("No collections");
+            if (!c.resident || &c == keep || (current_collection_set && &c == &*current_collection))
+                continue;
+            candidates.push_back(&c);
+            used += c.memory_usage();
         }
-        if (current_collection_set == false)
+
+        std::sort(candidates.begin(), candidates.end(), [](const Collection *a, const Collection *b)
         {
-            throw std::runtime_error("No current collection");
-        }
+            return a->last_used->load() < b->last_used->load();
+        });
 
-        current_collection->remove_documents(pattern, true);
+        for (Collection *c : candidates)
+        {
+            if (used <= memory_budget && memory_budget != 0)
+                break;
+            used -= c->memory_usage();
+            c->cache_binary(cache_path(*c));
+            c->clear_from_ram();
+            c->resident = false;
+        }
     }
 
-private:
-    std::string temp_filepath;
-    std::vector<Collection> collections;
-    std::vector<Collection>::iterator current_collection; // change to pointer? same syntax mostly
-    bool current_collection_set;
+    // runs op on a named collection under its lock, loading it first if it isn't resident
+    template <typename Lock, typename F>
+    std::invoke_result_t<F, Collection &> with_collection(const std::string &name, F &&op)
+    {
+        std::shared_lock catalog(catalog_mutex);
+        Collection *c = &find_collection(name);
+        while (!c->resident)
+        {
+            catalog.unlock();
+            {
+                std::unique_lock exclusive(catalog_mutex);
+                make_resident(find_collection(name));
+                evict_to_budget(&find_collection(name));
+            }
+            catalog.lock();
+            c = &find_collection(name);
+        }
+        c->last_used->store(++use_clock);
+        Lock lock(*c->mutex);
+        return op(*c);
+    }
 };
 
 #endif //__DATABASE_H__
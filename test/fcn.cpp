@@ -108,8 +108,103 @@ TEST(InactiveCollectionCache, CacheFileExist)
 
     db.add_collection("collection2");
     db.set_current_collection("collection2");
-    ASSERT_TRUE(std::filesystem::exists("test/temps/collection1.json.tmp")) << "failed to find temp file for collection 1";
-    
+    ASSERT_TRUE(std::filesystem::exists("test/temps/collection1.bin.tmp")) << "failed to find temp file for collection 1";
+    EXPECT_FALSE(std::filesystem::exists("test/temps/collection1.json.tmp")) << "collection 1 was also cached as json";
+
+    db.set_current_collection("collection1");
+    ASSERT_EQ(db.get_ids(), ids) << "Cached collection did not restore the same ids";
+    EXPECT_EQ(db.get_document(ids[0]).get<std::string>("field1"), "\"data1\"") << "first document not restored";
+    EXPECT_EQ(db.get_document(ids[1]).get<int>("field1"), 1234) << "second document not restored";
+    EXPECT_EQ(db.get_document(ids[2]).get<std::string>("field2"), "\"World\"") << "third document not restored";
+}
+
+TEST(InactiveCollectionCache, TruncatedCacheLeavesCollectionUnchanged)
+{
+    Collection c("collection1", "test/saves/test2.json");
+    c.read("test/saves/test2.json");
+    c.cache_binary("test/temps/collection1.bin.tmp");
+    std::filesystem::resize_file("test/temps/collection1.bin.tmp", std::filesystem::file_size("test/temps/collection1.bin.tmp") - 4);
+
+    Collection restored("collection1");
+    EXPECT_ANY_THROW(restored.load_binary("test/temps/collection1.bin.tmp")) << "Truncated cache loaded";
+    std::filesystem::remove("test/temps/collection1.bin.tmp");
+    EXPECT_EQ(restored.size(), 0) << "Truncated cache left documents behind";
+
+    restored.read("test/saves/test2.json");
+    EXPECT_EQ(restored.size(), 3) << "Falling back to the json source didn't load it cleanly";
+}
+
+TEST(InactiveCollectionCache, CorruptCacheRejected)
+{
+    Collection c("collection1", "test/saves/test2.json");
+    c.set_preparsed(true);
+    c.read("test/saves/test2.json");
+    c.cache_binary("test/temps/collection1.bin.tmp");
+
+    std::ifstream file("test/temps/collection1.bin.tmp", std::ios::binary);
+    std::string cache((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    file.close();
+    std::filesystem::remove("test/temps/collection1.bin.tmp");
+    auto u64_at = [&](size_t pos)
+    {
+        uint64_t n;
+        std::memcpy(&n, cache.data() + pos, sizeof(n));
+        return n;
+    };
+    const size_t first = 16; // magic and count
+    const size_t first_tape = first + 24 + u64_at(first + 8);
+    const size_t second = first_tape + u64_at(first + 16) * sizeof(json_node);
+    ASSERT_GT(u64_at(first + 16), 0) << "Cache written without tapes";
+
+    auto rejected = [](const std::string &data)
+    {
+        {
+            std::ofstream out("test/temps/corrupt.bin.tmp", std::ios::binary);
+            out << data;
+        }
+        Collection restored("collection1");
+        restored.set_preparsed(true);
+        bool threw = false;
+        try
+        {
+            restored.load_binary("test/temps/corrupt.bin.tmp");
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        std::filesystem::remove("test/temps/corrupt.bin.tmp");
+        return threw && restored.size() == 0;
+    };
+
+    EXPECT_FALSE(rejected(cache)) << "Intact cache rejected";
+
+    std::string past_json = cache;
+    uint32_t end = 1 << 20;
+    std::memcpy(past_json.data() + first_tape + offsetof(json_node, end), &end, sizeof(end));
+    EXPECT_TRUE(rejected(past_json)) << "Tape node reaching past its json loaded";
+
+    std::string wrong_next = cache;
+    uint32_t next = 0;
+    std::memcpy(wrong_next.data() + first_tape + offsetof(json_node, next), &next, sizeof(next));
+    EXPECT_TRUE(rejected(wrong_next)) << "Tape node pointing backwards loaded";
+
+    std::string duplicate = cache;
+    std::memcpy(duplicate.data() + second, cache.data() + first, sizeof(uint64_t));
+    EXPECT_TRUE(rejected(duplicate)) << "Duplicate ids loaded";
+}
+
+TEST(InactiveCollectionCache, JsonCacheFormat)
+{
+    Collection c("collection1", "test/saves/test2.json");
+    c.read("test/saves/test2.json");
+    std::vector<size_t> ids;
+    for (const Document &d : c)
+    {
+        ids.push_back(d.get_id());
+    }
+    c.cache("test/temps/collection1.json.tmp");
+
     std::ifstream file("test/temps/collection1.json.tmp");
     if (!file.is_open())
     {
@@ -122,6 +217,8 @@ TEST(InactiveCollectionCache, CacheFileExist)
     {
         lines.push_back(buffer);
     }
+    file.close();
+    std::filesystem::remove("test/temps/collection1.json.tmp");
 
     std::vector<std::string> expected = {"{",R"({"field1":"data1","field2":"data2"},)",R"({"field1":1234,"field2":true},)",R"({"field1":"Hello","field2":"World"})","}"};
     for (size_t i = 0; i < 3; i++)
@@ -134,6 +231,4 @@ TEST(InactiveCollectionCache, CacheFileExist)
     {
         EXPECT_EQ(lines[i], expected[i]) << "Line from file did not match expected";
     }
-    
-
 }
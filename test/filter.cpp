@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+TEST(FilterRefs, PointIntoCollection)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 0; i < 50; i++)
+    {
+        db.add_document("{\"even\":" + std::string(i % 2 ? "false" : "true") + ",\"n\":" + std::to_string(i) + "}");
+    }
+
+    for (bool parallel : {true, false})
+    {
+        auto refs = db.get_document_refs(R"("even"=true)", parallel);
+        ASSERT_EQ(refs.size(), 25) << "Wrong number of matches";
+        for (const Document *d : refs)
+        {
+            EXPECT_EQ(d, &db.get_document(d->get_id())) << "Result is not a pointer into the collection";
+            EXPECT_EQ(d->get<int>("n") % 2, 0) << "Result doesn't match the pattern";
+        }
+        for (size_t i = 1; i < refs.size(); i++)
+        {
+            EXPECT_LT(refs[i - 1]->get_id(), refs[i]->get_id()) << "Results are out of collection order";
+        }
+    }
+}
+
+TEST(FilterRefs, CopiesMatchRefs)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.add_document(R"({"k":"a"})");
+    db.add_document(R"({"k":"b"})");
+    db.add_document(R"({"k":"a"})");
+
+    auto refs = db.get_document_refs(R"("k"="a")");
+    auto copies = db.get_documents(R"("k"="a")");
+    ASSERT_EQ(refs.size(), copies.size()) << "Copying wrapper returned different count";
+    for (size_t i = 0; i < refs.size(); i++)
+    {
+        EXPECT_EQ(refs[i]->get_id(), copies[i].get_id()) << "Copying wrapper returned different documents";
+    }
+}
+
+TEST(PreparedFilter, ReusedAcrossCalls)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.add_document(R"({"user":{"name":"ann","roles":["admin","dev"]},"active":true})");
+    db.add_document(R"({"user":{"name":"bob","roles":["dev"]},"active":true})");
+    db.add_document(R"({"user":{"name":"cat","roles":["admin"]},"active":false})");
+
+    Filter admins(R"("user"."roles"[0] = "admin" & "active" = true)");
+    EXPECT_EQ(db.get_documents(admins).size(), 1) << "Prepared filter matched wrong documents";
+    EXPECT_EQ(db.get_documents(admins, false).size(), 1) << "Prepared filter differs when run serially";
+
+    db.update_documents(admins, R"({"active":false})");
+    EXPECT_EQ(db.get_documents(admins).size(), 0) << "Prepared filter matched after update";
+
+    Filter inactive(R"("active"=false)");
+    db.remove_documents(inactive, false);
+    EXPECT_EQ(db.get_ids().size(), 1) << "Prepared filter removed wrong documents";
+    EXPECT_EQ(db.get_documents(inactive).size(), 0) << "Prepared filter matched removed documents";
+}
+
+TEST(PreparedFilter, MissingPathsDontMatch)
+{
+    Document d(R"({"a":{"b":[1,{"c":2}]}})");
+    EXPECT_TRUE(Filter(R"("a"."b"[1]."c"=2)").matches(d)) << "Nested path didn't match";
+    EXPECT_FALSE(Filter(R"("a"."b"[5]=1)").matches(d)) << "Out of bounds index matched";
+    EXPECT_FALSE(Filter(R"("a"[0]=1)").matches(d)) << "Index into object matched";
+    EXPECT_FALSE(Filter(R"("a"."x"=1)").matches(d)) << "Missing key matched";
+
+    d.build_tape();
+    EXPECT_TRUE(Filter(R"("a"."b"[1]."c"=2)").matches(d)) << "Nested path didn't match parsed document";
+    EXPECT_FALSE(Filter(R"("a"[0]=1)").matches(d)) << "Index into object matched parsed document";
+}
+
+TEST(PreparedFilter, TypedComparisons)
+{
+    Document d(R"({"n":1,"x":2.5e1,"s":"beta","b":true,"list":[1,2]})");
+    EXPECT_TRUE(Filter(R"("n"=1.0)").matches(d)) << "Equal numbers in different forms didn't match";
+    EXPECT_TRUE(Filter(R"("x"=25)").matches(d)) << "Exponent didn't compare by value";
+    EXPECT_FALSE(Filter(R"("n"="1")").matches(d)) << "Number matched a string";
+    EXPECT_TRUE(Filter(R"("n"!=2)").matches(d)) << "!= didn't match a different value";
+    EXPECT_FALSE(Filter(R"("n"!=1.0)").matches(d)) << "!= matched an equal value";
+    EXPECT_FALSE(Filter(R"("missing"!=1)").matches(d)) << "!= matched a missing path";
+
+    EXPECT_TRUE(Filter(R"("n"<2)").matches(d)) << "< failed";
+    EXPECT_FALSE(Filter(R"("n"<1)").matches(d)) << "< matched an equal value";
+    EXPECT_TRUE(Filter(R"("n"<=1)").matches(d)) << "<= failed";
+    EXPECT_TRUE(Filter(R"("x">9)").matches(d)) << "> compared as text";
+    EXPECT_TRUE(Filter(R"("x">=25&"n">0)").matches(d)) << ">= failed";
+    EXPECT_TRUE(Filter(R"("s">"alpha"&"s"<"gamma")").matches(d)) << "String range failed";
+    EXPECT_FALSE(Filter(R"("s">1)").matches(d)) << "String ordered against a number";
+    EXPECT_FALSE(Filter(R"("b">false)").matches(d)) << "Literal was ordered";
+
+    EXPECT_TRUE(Filter(R"("s" in ["alpha", "beta"])").matches(d)) << "in failed";
+    EXPECT_TRUE(Filter(R"("n" in [3, 1.0])").matches(d)) << "in didn't compare numbers by value";
+    EXPECT_FALSE(Filter(R"("n" in [2, "1"])").matches(d)) << "in matched a missing value";
+    EXPECT_TRUE(Filter(R"("list"=[1,2])").matches(d)) << "Array equality failed";
+
+    EXPECT_ANY_THROW(Filter(R"("n"!1)")) << "Lone ! accepted";
+    EXPECT_ANY_THROW(Filter(R"("n"==1)")) << "== accepted as = with value =1";
+    EXPECT_ANY_THROW(Filter(R"("n"=<1)")) << "=< accepted";
+    EXPECT_ANY_THROW(Filter(R"("n"<>1)")) << "<> accepted";
+    EXPECT_ANY_THROW(Filter(R"("n"!==1)")) << "!== accepted";
+    EXPECT_ANY_THROW(Filter(R"("n")")) << "Missing operator accepted";
+    EXPECT_ANY_THROW(Filter(R"("n" in 1)")) << "in without a list accepted";
+}
+
+TEST(Projection, ReturnsRequestedPaths)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 50; i++)
+    {
+        std::string extra = i % 5 ? "" : ",\"tag\":\"five\"";
+        ids.push_back(db.add_document("{\"n\":" + std::to_string(i) + ",\"name\":\"doc" + std::to_string(i) + "\",\"inner\":{\"list\":[" + std::to_string(i * 2) + "]}" + extra + "}"));
+    }
+
+    Projection projection({R"("name")", R"("inner"."list"[0])", R"("tag")"});
+    for (bool parallel : {true, false})
+    {
+        auto rows = db.get_documents(R"("n"<10)", projection, parallel);
+        ASSERT_EQ(rows.size(), 10) << "Wrong number of rows";
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            EXPECT_EQ(rows[i].id, ids[i]) << "Rows out of document order";
+            EXPECT_EQ(rows[i].get<std::string>(0), "\"doc" + std::to_string(i) + "\"") << "Wrong projected string";
+            EXPECT_EQ(rows[i].get<int>(1), 2 * (int)i) << "Wrong projected nested value";
+            EXPECT_EQ(rows[i].has(2), i % 5 == 0) << "Missing path not reported";
+        }
+        EXPECT_ANY_THROW(rows[1].get<std::string>(2)) << "Missing path returned a value";
+    }
+
+    db.create_index(R"("n")");
+    db.set_preparsed(true);
+    auto rows = db.get_documents(Filter(R"("n">=45)"), projection);
+    ASSERT_EQ(rows.size(), 5) << "Indexed projection returned wrong count";
+    EXPECT_EQ(rows[0].values[0], std::optional<std::string>("\"doc45\"")) << "Indexed projection returned wrong value";
+    EXPECT_EQ(db.get_collection("foo").get_documents(R"("n"=3)", projection).at(0).get<int>(1), 6) << "Handle projection failed";
+    EXPECT_ANY_THROW(Projection(std::vector<std::string>())) << "Empty projection accepted";
+}
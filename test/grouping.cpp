@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include "database.h"
+
+TEST(Aggregate, CountSumMinMaxAvg)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 1; i <= 100; i++)
+    {
+        std::string price = i % 10 == 0 ? "\"n/a\"" : std::to_string(i) + ".5";
+        db.add_document("{\"n\":" + std::to_string(i) + ",\"price\":" + price + ",\"group\":\"g" + std::to_string(i % 3) + "\"}");
+    }
+    db.add_document(R"({"n":0})");
+
+    for (bool parallel : {true, false})
+    {
+        EXPECT_EQ(db.count_documents(R"("n">50)", parallel), 50) << "Wrong count";
+        EXPECT_EQ(db.count_documents(R"("n">500)", parallel), 0) << "Count of no matches";
+
+        aggregate_result r = db.aggregate(R"("n"<=20)", R"("price")", parallel);
+        EXPECT_EQ(r.count, 21) << "Wrong document count";
+        EXPECT_EQ(r.values, 18) << "Non-numbers or missing paths were aggregated";
+        double expected_sum = 0;
+        for (int i = 1; i <= 20; i++)
+        {
+            if (i % 10)
+                expected_sum += i + 0.5;
+        }
+        EXPECT_DOUBLE_EQ(r.sum, expected_sum) << "Wrong sum";
+        EXPECT_DOUBLE_EQ(r.min, 1.5) << "Wrong min";
+        EXPECT_DOUBLE_EQ(r.max, 19.5) << "Wrong max";
+        EXPECT_DOUBLE_EQ(r.avg(), expected_sum / 18) << "Wrong average";
+    }
+
+    aggregate_result none = db.aggregate(R"("n"<0)", R"("price")");
+    EXPECT_EQ(none.count, 0) << "Aggregated with no matches";
+    EXPECT_TRUE(std::isnan(none.avg())) << "Average of nothing isn't NaN";
+}
+
+TEST(Aggregate, GroupBy)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 0; i < 60; i++)
+    {
+        db.add_document("{\"n\":" + std::to_string(i) + ",\"group\":\"g" + std::to_string(i % 3) + "\",\"size\":" + std::to_string(i % 2) + (i % 4 == 1 ? ".0" : "") + "}");
+    }
+    db.add_document(R"({"n":100})");
+
+    aggregate_groups groups = db.aggregate_by(R"("n">=0)", R"("n")", R"("group")");
+    ASSERT_EQ(groups.size(), 3) << "Wrong number of groups";
+    for (int g = 0; g < 3; g++)
+    {
+        const aggregate_result &r = groups.at(filter_value("\"g" + std::to_string(g) + "\""));
+        EXPECT_EQ(r.count, 20) << "Wrong count in group " << g;
+        EXPECT_EQ(r.min, g) << "Wrong min in group " << g;
+        EXPECT_EQ(r.max, 57 + g) << "Wrong max in group " << g;
+    }
+
+    // numbers group by value, so 1 and 1.0 share a group
+    aggregate_groups sizes = db.get_collection("foo").aggregate_by(R"("n">=0)", R"("n")", R"("size")", false);
+    ASSERT_EQ(sizes.size(), 2) << "Equal numbers in different forms grouped apart";
+    EXPECT_EQ(sizes.begin()->first.num, 0) << "Groups not sorted by value";
+    EXPECT_EQ(sizes.rbegin()->second.count, 30) << "Wrong count in numeric group";
+    for (bool parallel : {true, false})
+    {
+        // the first document holding 1 holds it as 1.0
+        aggregate_groups keyed = db.aggregate_by(R"("n">=0)", R"("n")", R"("size")", parallel);
+        EXPECT_EQ(keyed.rbegin()->first.text, "1.0") << "Group key not taken from the lowest id";
+    }
+    aggregate_groups none = db.aggregate_by(R"("n">=0)", R"("missing")", R"("group")");
+    EXPECT_EQ(none.begin()->second.values, 0);
+    EXPECT_EQ(none.begin()->second.min, std::numeric_limits<double>::infinity()) << "min of no numbers isn't +infinity";
+    EXPECT_EQ(none.begin()->second.max, -std::numeric_limits<double>::infinity()) << "max of no numbers isn't -infinity";
+
+    db.create_index(R"("group")");
+    EXPECT_EQ(db.aggregate_by(R"("group"="g1")", R"("n")", R"("group")").at(filter_value("\"g1\"")).count, 20) << "Indexed aggregate wrong";
+}
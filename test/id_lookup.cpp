@@ -0,0 +1,133 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <thread>
+#include "database.h"
+
+TEST(IdLookup, UnsortedIdsFromLoad)
+{
+    {
+        std::ofstream file("test/temps/unsorted_ids.json");
+        file << R"({"907":{"n":1},"305":{"n":2},"1011":{"n":3},"12":{"n":4}})";
+    }
+
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.load_current_collection("test/temps/unsorted_ids.json");
+    std::filesystem::remove("test/temps/unsorted_ids.json");
+
+    EXPECT_EQ(db.get_document(907).get<int>("n"), 1) << "Lookup of first loaded id failed";
+    EXPECT_EQ(db.get_document(305).get<int>("n"), 2) << "Lookup of smaller id after larger failed";
+    EXPECT_EQ(db.get_document(12).get<int>("n"), 4) << "Lookup of smallest id failed";
+    EXPECT_ANY_THROW(db.get_document(13)) << "Lookup of missing id didn't throw";
+
+    db.update_document(305, R"({"n":20})");
+    EXPECT_EQ(db.get_document(305).get<int>("n"), 20) << "Update of unsorted id failed";
+    db.remove_document(907);
+    EXPECT_ANY_THROW(db.get_document(907)) << "Removed id still found";
+    EXPECT_EQ(db.get_document(1011).get<int>("n"), 3) << "Lookup after removal failed";
+    EXPECT_EQ(db.get_document(12).get<int>("n"), 4) << "Lookup of moved document failed";
+}
+
+TEST(IdLookup, SurvivesBulkRemoval)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 1000; i++)
+    {
+        ids.push_back(db.add_document("{\"n\":" + std::to_string(i) + "}"));
+    }
+
+    db.remove_documents(R"("n"=500)", true);
+    db.remove_document(ids[10]);
+    db.remove_document(ids[999]);
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        if (i == 10 || i == 500 || i == 999)
+        {
+            EXPECT_ANY_THROW(db.get_document(ids[i])) << "Removed document " << i << " still found";
+            continue;
+        }
+        EXPECT_EQ(db.get_document(ids[i]).get<int>("n"), (int)i) << "Lookup of document " << i << " failed";
+    }
+    EXPECT_EQ(db.get_ids().size(), 997) << "Wrong number of documents after removals";
+}
+
+TEST(IdLookup, IdsArePerCollection)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.set_current_collection("foo");
+    size_t foo_first = db.add_document(R"({"n":1})");
+    size_t bar_first = db.get_collection("bar").add_document(R"({"n":2})");
+    size_t foo_second = db.add_document(R"({"n":3})");
+
+    EXPECT_EQ(foo_first, 0) << "Collection ids don't start at 0";
+    EXPECT_EQ(bar_first, 0) << "Ids shared across collections";
+    EXPECT_EQ(foo_second, 1) << "Another collection's add took an id";
+    EXPECT_EQ(db.get_document(foo_second).get<int>("n"), 3);
+}
+
+TEST(IdLookup, LoadedIdsAreNotReused)
+{
+    {
+        std::ofstream file("test/temps/loaded_ids.json");
+        file << R"({"41":{"n":1},"7":{"n":2}})";
+    }
+
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.load_current_collection("test/temps/loaded_ids.json");
+    std::filesystem::remove("test/temps/loaded_ids.json");
+
+    EXPECT_EQ(db.add_document(R"({"n":3})"), 42) << "New id not after the largest loaded one";
+    EXPECT_EQ(db.reserve_ids(10), 43) << "Reserved block not after the last id";
+    EXPECT_EQ(db.add_document(R"({"n":4})"), 53) << "Id from a reserved block handed out";
+}
+
+TEST(IdLookup, ReservedBlocksAcrossThreads)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    auto foo = db.get_collection("foo");
+
+    const int threads = 4, blocks = 50, block_size = 8;
+    std::vector<std::vector<size_t>> firsts(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&, t]
+        {
+            for (int b = 0; b < blocks; b++)
+            {
+                size_t first = foo.reserve_ids(block_size);
+                firsts[t].push_back(first);
+                for (size_t id = first; id < first + block_size; id++)
+                {
+                    foo.add_document(id, "{\"thread\":" + std::to_string(t) + "}");
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+
+    std::vector<size_t> all;
+    for (const auto &f : firsts)
+    {
+        all.insert(all.end(), f.begin(), f.end());
+    }
+    std::sort(all.begin(), all.end());
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        EXPECT_EQ(all[i], i * block_size) << "Reserved blocks overlap or leave gaps";
+    }
+    EXPECT_EQ(foo.get_ids().size(), threads * blocks * block_size) << "Adds with reserved ids lost";
+    EXPECT_EQ(foo.add_document(R"({"n":0})"), threads * blocks * block_size) << "Id after the reserved blocks not next";
+}
@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+TEST(PathIndex, EqualityFilterUsesIndex)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 0; i < 20; i++)
+    {
+        db.add_document("{\"group\":" + std::to_string(i % 4) + ",\"sub\":{\"name\":\"doc" + std::to_string(i) + "\"}}");
+    }
+    db.create_index(R"("group")");
+    db.create_index(R"("sub"."name")");
+
+    EXPECT_EQ(db.get_documents(R"("group"=1)").size(), 5) << "Indexed filter returned wrong count";
+    EXPECT_EQ(db.get_documents(R"("group"=7)").size(), 0) << "Indexed filter matched a missing value";
+    EXPECT_EQ(db.get_documents(R"("sub"."name"="doc3")").size(), 1) << "Indexed path filter failed";
+    EXPECT_EQ(db.get_documents(R"("group"=3&"sub"."name"="doc3")").size(), 1) << "Indexed filter didn't check remaining keys";
+    EXPECT_EQ(db.get_documents(R"("group"=2&"sub"."name"="doc3")").size(), 0) << "Indexed filter ignored remaining keys";
+}
+
+TEST(PathIndex, MaintainedByMutations)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.create_index(R"("state")");
+
+    size_t a = db.add_document(R"({"state":"new"})");
+    size_t b = db.add_document(R"({"state":"new"})");
+    db.add_document(R"({"other":true})");
+    EXPECT_EQ(db.get_documents(R"("state"="new")").size(), 2) << "Index missed added documents";
+
+    db.update_document(a, R"({"state":"done"})");
+    EXPECT_EQ(db.get_documents(R"("state"="new")").size(), 1) << "Index kept stale value after update";
+    EXPECT_EQ(db.get_documents(R"("state"="done")").size(), 1) << "Index missed updated value";
+
+    db.update_documents(R"("state"="new")", R"({"state":"done"})");
+    EXPECT_EQ(db.get_documents(R"("state"="done")").size(), 2) << "Index missed bulk update";
+
+    db.remove_document(b);
+    EXPECT_EQ(db.get_documents(R"("state"="done")").size(), 1) << "Index kept removed document";
+
+    db.remove_documents(R"("state"="done")");
+    EXPECT_EQ(db.get_documents(R"("state"="done")").size(), 0) << "Index kept bulk removed document";
+    EXPECT_EQ(db.get_ids().size(), 1) << "Wrong documents removed";
+}
+
+TEST(PathIndex, DuplicateAndMissingIndexThrow)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.create_index(R"("a")");
+    EXPECT_ANY_THROW(db.create_index(R"("a")")) << "Duplicate index didn't throw";
+    EXPECT_NO_THROW(db.drop_index(R"("a")")) << "Dropping index threw";
+    EXPECT_ANY_THROW(db.drop_index(R"("a")")) << "Dropping missing index didn't throw";
+}
+
+TEST(PathIndex, RangeFiltersUseIndex)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 0; i < 40; i++)
+    {
+        db.add_document("{\"n\":" + std::to_string(i) + (i % 2 ? ".0" : "") + ",\"s\":\"k" + std::to_string(i % 10) + "\"}");
+    }
+    db.add_document(R"({"n":"10"})");
+    db.add_document(R"({"n":null})");
+
+    std::vector<std::string> patterns = {
+        R"("n"<10)", R"("n"<=10)", R"("n">30)", R"("n">=30.0)", R"("n">-5&"n"<5)", R"("n" in [3, 4.0, "10", 99])",
+        R"("n"=10)", R"("n"="10")", R"("n"!=10)", R"("s">="k5")", R"("s"<"k2")", R"("n">"0")"};
+    std::vector<std::vector<size_t>> expected;
+    for (const auto &pattern : patterns)
+    {
+        std::vector<size_t> ids;
+        for (const Document &d : db.get_documents(pattern, false))
+            ids.push_back(d.get_id());
+        expected.push_back(ids);
+    }
+    EXPECT_EQ(expected[0].size(), 10) << "Numeric range compared as text";
+    EXPECT_EQ(expected[5].size(), 3) << "in matched wrong documents";
+    EXPECT_EQ(expected[11].size(), 1) << "String range crossed into numbers";
+
+    db.create_index(R"("n")");
+    db.create_index(R"("s")");
+    for (size_t i = 0; i < patterns.size(); i++)
+    {
+        std::vector<size_t> ids;
+        for (const Document &d : db.get_documents(patterns[i], false))
+            ids.push_back(d.get_id());
+        EXPECT_EQ(ids, expected[i]) << "Indexed result differs for " << patterns[i];
+    }
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "database.h"
+
+TEST(BatchInsert, ContiguousIdsInOrder)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.add_document(R"({"n":-1})");
+
+    std::vector<std::string> jsons;
+    for (int i = 0; i < 1000; i++)
+    {
+        jsons.push_back("{ \"n\" : " + std::to_string(i) + " }");
+    }
+    auto [first, last] = db.add_documents(std::move(jsons));
+    EXPECT_EQ(last - first, 1000) << "Wrong id range size";
+    for (size_t id = first; id < last; id++)
+    {
+        EXPECT_EQ(db.get_document(id).get<int>("n"), int(id - first)) << "Ids don't follow input order";
+    }
+    EXPECT_EQ(db.get_documents(R"("n">=500)").size(), 500) << "Batch not filterable";
+
+    size_t next = db.add_document(R"({"n":1000})");
+    EXPECT_EQ(next, last) << "Id after a batch isn't the next one";
+}
+
+TEST(BatchInsert, InvalidDocumentAddsNothing)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+
+    std::vector<std::string> jsons = {R"({"n":1})", R"({"n":)", R"({"n":3})"};
+    EXPECT_THROW(db.add_documents(std::move(jsons)), std::runtime_error) << "Invalid document accepted";
+    EXPECT_EQ(db.get_ids().size(), 0) << "Part of a failed batch was added";
+    EXPECT_THROW(db.add_documents_from_buffer(R"({"n":1}{"n":)"), std::runtime_error) << "Truncated buffer accepted";
+    EXPECT_EQ(db.get_ids().size(), 0) << "Part of a truncated buffer was added";
+}
+
+TEST(BatchInsert, FromBuffer)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+
+    auto [first, last] = db.add_documents_from_buffer("[{\"n\": 0, \"s\":\"{}\"},\n {\"n\":1} ,{\"n\":2}]");
+    EXPECT_EQ(last - first, 3) << "Wrong number of documents split from buffer";
+    EXPECT_EQ(db.get_document(first).get<std::string>("s"), "\"{}\"") << "Brackets in strings split the buffer";
+    EXPECT_EQ(db.get_document(first + 2).get<int>("n"), 2) << "Wrong last document";
+
+    auto more = db.get_collection("foo").add_documents_from_buffer(R"({"n":3}{"n":4})");
+    EXPECT_EQ(more.first, last) << "Handle batch ids not contiguous with earlier ones";
+    EXPECT_EQ(db.get_ids().size(), 5) << "Handle batch not added";
+}
+
+TEST(BatchInsert, ConcurrentBatchesGetDisjointRanges)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+
+    std::pair<size_t, size_t> ranges[2];
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 2; t++)
+    {
+        threads.emplace_back([&, t]
+        {
+            std::vector<std::string> jsons(500, R"({"n":1})");
+            ranges[t] = db.get_collection("foo").add_documents(std::move(jsons));
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(ranges[0].second - ranges[0].first, 500);
+    EXPECT_EQ(ranges[1].second - ranges[1].first, 500);
+    EXPECT_TRUE(ranges[0].second <= ranges[1].first || ranges[1].second <= ranges[0].first) << "Batch id ranges overlap";
+    EXPECT_EQ(db.get_collection("foo").get_ids().size(), 1000) << "Concurrent batches lost documents";
+}
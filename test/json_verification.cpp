@@ -179,3 +179,75 @@ TEST(JsonVerification, OtherIncorrectData) // {"...":nottrue/false/null}
     auto res = verify_json(json);
 	EXPECT_TRUE(res) << "non-legal value didn't throw";
 }
+
+// every input above plus whitespace variants; minify_json must agree with the two pass functions it replaces
+std::vector<std::string> minify_inputs()
+{
+	std::vector<std::string> inputs = {
+		"",
+		"{}",
+		R"({"String":"string","Number":3.14159,"True":true,"False":false,"Null":null})",
+		R"({"arrayField":["Hello",123,0.12,true,false,null]})",
+		R"({"objectField":{"String":"string","Number":3.14159,"True":true,"False":false,"Null":null}})",
+		R"({"array":[[1,2,3,4,5],{"foo":true,"bar":false}]})",
+		R"({"object":{"object":{"foo":true,"bar":false},"array":[1,2,3,4,5]}})",
+		R"("foo":true,"bar":false})",
+		R"({"foo":true,"bar":false)",
+		R"({"foo":"string","bar":42,})",
+		R"({"foo":42"bar":3.14159})",
+		R"({"foo"42})",
+		R"({:"value"})",
+		R"({"foo":42,:"value"})",
+		R"({"":value})",
+		R"({"key":})",
+		R"({"key1":"value1","key2":,"key3":"value3"})",
+		R"({"field1":"string1","field2":"string2,"field3":"string3"})",
+		R"({"field1":"string1","field2":string2","field3":"string3"})",
+		R"({"Array":[foo,bar,baz,"field2":"string"})",
+		R"({"Array":foo,bar,baz],"field2":"string"})",
+		R"({"Array":[1,2,3,,5]})",
+		R"({"Array":[1,2,3,]})",
+		R"({"Array":[,1,2,3,4]})",
+		R"({"Array":["foo","bar""baz","quux"]})",
+		R"({{"field":{"subfield1":true,"subfield2":42,"field2":123})",
+		R"({{"field":"subfield1":true,"subfield2":42},"field2":123})",
+		R"({"bad_number":-123d5})",
+		R"({"bad_number":1.23e})",
+		R"({"bad_number":e42})",
+		R"({"field":foo})",
+		" { \"spaced\" :\t[ 1 , -0.5e+3 , \"a b\" , { } , [ ] ] ,\r\n \"n\" : null , \"d\" : delete } \n",
+		R"({"escaped":"quote \" and \\","raw":"tab\there"})",
+		"{\"split\":tr ue,\"number\":1 2}",
+		R"({"lenient":[01,1.,-,1e+]})",
+		R"({"a":1}x)",
+		"{\"a\":1} {\"b\":2}",
+		std::string("{\"nul\":\"a\0b\"}", 14),
+	};
+	return inputs;
+}
+
+TEST(JsonVerification, MinifyMatchesTwoPass)
+{
+	for (const std::string &input : minify_inputs())
+	{
+		std::string expected = de_whitespace_json(input);
+		auto expected_failure = verify_json(expected);
+		std::string minified;
+		auto failure = minify_json(input, minified);
+		EXPECT_EQ(failure, expected_failure) << "different result for: " << input;
+		if (!failure)
+		{
+			EXPECT_EQ(minified, expected) << "different output for: " << input;
+			EXPECT_EQ(verify_minified_json(minified), std::nullopt) << "minified json rejected: " << minified;
+		}
+	}
+}
+
+TEST(JsonVerification, MinifyKeepsErrorMessages)
+{
+	std::string minified;
+	EXPECT_EQ(minify_json("", minified), std::optional<std::string>("json is an empty string"));
+	EXPECT_EQ(minify_json(R"({ "foo" : "string", "bar" : 42, })", minified),
+			  std::optional<std::string>("json verification failed: trailing comma in object"));
+	EXPECT_EQ(verify_minified_json(R"({"field":foo})"), verify_json(R"({"field":foo})"));
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include "database.h"
+
+TEST(MemoryMap, DocumentsViewTheFile)
+{
+    {
+        std::ofstream file("test/temps/mapped.json");
+        file << "[\n\t{\"n\":1,\"s\":\"a b\"},\n\t{ \"n\" : 2 },\n\t{\"n\":3,\"o\":{\"k\":[4]}}\n]";
+    }
+
+    Collection c("foo", "test/temps/mapped.json");
+    c.set_memory_mapped(true);
+    c.read("test/temps/mapped.json");
+    std::filesystem::remove("test/temps/mapped.json"); // the mapping keeps the data alive
+
+    std::vector<const Document *> docs;
+    for (const Document &d : c)
+    {
+        docs.push_back(&d);
+    }
+    ASSERT_EQ(docs.size(), 3) << "Wrong number of mapped documents";
+    EXPECT_TRUE(docs[0]->is_mapped()) << "Minified document was copied";
+    EXPECT_FALSE(docs[1]->is_mapped()) << "Document with whitespace wasn't de_whitespaced";
+    EXPECT_EQ(docs[0]->get<std::string>("s"), "\"a b\"");
+    EXPECT_EQ(docs[1]->get<int>("n"), 2);
+    EXPECT_EQ(docs[2]->query<int>(R"("o"."k"[0])"), 4);
+    EXPECT_EQ(c.get_documents(R"("n"=3)", false).size(), 1) << "Filter on mapped documents failed";
+
+    c.set_preparsed(true);
+    EXPECT_EQ(docs[2]->query<int>(R"("o"."k"[0])"), 4) << "Tape over mapped document failed";
+
+    c.update_document(docs[0]->get_id(), R"({"n":10})");
+    EXPECT_FALSE(docs[0]->is_mapped()) << "Updated document still views the file";
+    EXPECT_EQ(docs[0]->get<int>("n"), 10);
+    EXPECT_EQ(docs[0]->get<std::string>("s"), "\"a b\"") << "Update lost mapped fields";
+}
+
+TEST(MemoryMap, CopiesOutliveTheMapping)
+{
+    {
+        std::ofstream file("test/temps/mapped_copy.json");
+        file << "{\"n\":1}{\"n\":2}";
+    }
+
+    Database db("test/temps");
+    db.add_collection_from_file("foo", "test/temps/mapped_copy.json");
+    db.add_collection("bar");
+    db.set_memory_mapped(true);
+    db.set_current_collection("foo");
+    std::filesystem::remove("test/temps/mapped_copy.json");
+
+    auto copies = db.get_documents(R"("n"=2)");
+    ASSERT_EQ(copies.size(), 1);
+    EXPECT_FALSE(copies[0].is_mapped()) << "Copy still views the file";
+
+    db.set_current_collection("bar"); // unmaps foo
+    EXPECT_EQ(copies[0].get<int>("n"), 2) << "Copy didn't survive the unmap";
+
+    db.set_current_collection("foo"); // reloaded from the cache
+    EXPECT_EQ(db.get_documents(R"("n"=1)").size(), 1) << "Mapped collection wasn't cached";
+}
+
+TEST(MemoryMap, SaveOverTheMappedFile)
+{
+    {
+        std::ofstream file("test/temps/mapped_save.json");
+        file << "[{\"n\":1},{\"n\":2}]";
+    }
+
+    {
+        Database db("test/temps");
+        db.set_memory_mapped(true);
+        db.add_collection_from_file("foo", "test/temps/mapped_save.json");
+        db.set_current_collection("foo");
+        db.add_document(R"({"n":3})");
+        db.save_current_collection("test/temps/mapped_save.json");
+        EXPECT_EQ(db.get_documents(R"("n"<3)").size(), 2) << "Mapped documents unreadable after saving over their file";
+    }
+
+    Database db("test/temps");
+    db.add_collection_from_file("foo", "test/temps/mapped_save.json");
+    db.set_current_collection("foo");
+    std::filesystem::remove("test/temps/mapped_save.json");
+    EXPECT_EQ(db.get_ids().size(), 3) << "Saved file is missing documents";
+    EXPECT_FALSE(std::filesystem::exists("test/temps/mapped_save.json.tmp")) << "Temp file left behind";
+}
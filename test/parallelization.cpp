@@ -98,3 +98,396 @@ TEST(RuntimeTest, remove_documentsAveragePath)
 
 	ASSERT_LT(parallel_time, linear_time);
 }
+
+TEST(RuntimeTest, update_documentsScaling)
+{
+	const int count = 20000;
+	auto fill = [&](Database &db, const std::string &name)
+	{
+		db.add_collection(name);
+		db.set_current_collection(name);
+		for (int i = 0; i < count; i++)
+		{
+			db.add_document("{\"group\":" + std::to_string(i % 4) + ",\"name\":\"Document " + std::to_string(i) + "\",\"tags\":[\"a\",\"b\"],\"stats\":{\"hits\":" + std::to_string(i) + "}}");
+		}
+	};
+	std::string path = R"("group"=1)";
+	std::string update = R"({"name":"renamed","stats":{"hits":0}})";
+
+	// one update_document call per match, as the parallel branch used to do
+	Database per_document_db("test/temps");
+	fill(per_document_db, "Per Document");
+	std::vector<size_t> matched;
+	for (const Document &d : per_document_db.get_documents(path, false))
+	{
+		matched.push_back(d.get_id());
+	}
+	auto t1 = hr_clock::now();
+	for (size_t id : matched)
+	{
+		per_document_db.update_document(id, update);
+	}
+	double per_document_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+	std::cout << "per document: " << per_document_time << " ms\n";
+
+	std::vector<Document> expected = per_document_db.get_documents(path, false);
+	int max_threads = omp_get_max_threads();
+	for (int threads = 1; threads <= max_threads; threads *= 2)
+	{
+		Database db("test/temps");
+		fill(db, "Bulk " + std::to_string(threads));
+		omp_set_num_threads(threads);
+		auto t2 = hr_clock::now();
+		db.update_documents(path, update, threads > 1);
+		double bulk_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+		std::cout << "bulk with " << threads << " threads: " << bulk_time << " ms\n";
+
+		auto result = db.get_documents(path, false);
+		ASSERT_EQ(result.size(), expected.size());
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			EXPECT_EQ(result[i].get<std::string>("name"), "\"renamed\"") << "bulk update missed document " << i;
+			EXPECT_EQ(result[i].query<int>(R"("stats"."hits")"), 0) << "bulk update missed nested field " << i;
+		}
+	}
+	omp_set_num_threads(max_threads);
+}
+
+TEST(RuntimeTest, set_current_collectionSwapLatency)
+{
+	double json_time = 0.00;
+	double binary_time = 0.00;
+	for (int count : {1000, 10000, 50000})
+	{
+		Collection c("Swap");
+		c.set_preparsed(true);
+		for (int i = 0; i < count; i++)
+		{
+			c.add_document("{\"n\":" + std::to_string(i) + ",\"name\":\"Document " + std::to_string(i) + "\",\"tags\":[\"a\",\"b\",{\"c\":1.5}],\"stats\":{\"hits\":" + std::to_string(i) + ",\"ok\":true}}");
+		}
+
+		// the old swap: cache as json keyed by id, then re-tokenize, verify and parse it
+		auto t1 = hr_clock::now();
+		c.cache("test/temps/swap.json.tmp");
+		Collection json_copy("Swap");
+		json_copy.set_preparsed(true);
+		json_copy.load("test/temps/swap.json.tmp");
+		json_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+
+		auto t2 = hr_clock::now();
+		c.cache_binary("test/temps/swap.bin.tmp");
+		Collection binary_copy("Swap");
+		binary_copy.set_preparsed(true);
+		binary_copy.load_binary("test/temps/swap.bin.tmp");
+		binary_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+
+		std::filesystem::remove("test/temps/swap.json.tmp");
+		std::filesystem::remove("test/temps/swap.bin.tmp");
+		std::cout << count << " documents: json " << json_time << " ms, binary " << binary_time << " ms\n";
+
+		ASSERT_EQ(binary_copy.size(), (size_t)count);
+		auto found = binary_copy.get_documents(R"("stats"."hits"=)" + std::to_string(count / 2), false);
+		ASSERT_EQ(found.size(), 1) << "binary cache lost a document";
+		EXPECT_TRUE(found[0].is_parsed()) << "binary cache didn't keep the tape";
+		EXPECT_EQ(found[0].query<double>(R"("tags"[2]."c")"), 1.5) << "binary cache tape is wrong";
+	}
+	ASSERT_LT(binary_time, json_time);
+}
+
+TEST(RuntimeTest, add_documentWalThroughput)
+{
+	const int count = 20000;
+	std::string dir = "test/temps/wal_throughput";
+	auto ingest = [&](Database &db)
+	{
+		db.add_collection("Ingest");
+		db.set_current_collection("Ingest");
+		auto t1 = hr_clock::now();
+		for (int i = 0; i < count; i++)
+		{
+			db.add_document("{\"n\":" + std::to_string(i) + ",\"name\":\"Document " + std::to_string(i) + "\",\"tags\":[\"a\",\"b\"]}");
+		}
+		return duration<double, std::milli>(hr_clock::now() - t1).count();
+	};
+
+	Database memory_db("test/temps");
+	double memory_time = ingest(memory_db);
+
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	double wal_time;
+	{
+		Database wal_db(dir, write_ahead_log::sync_policy::batched);
+		wal_time = ingest(wal_db);
+	}
+	std::cout << "in memory: " << memory_time << " ms, batched log: " << wal_time << " ms\n";
+
+	Database recovered(dir, write_ahead_log::sync_policy::batched);
+	recovered.set_current_collection("Ingest");
+	EXPECT_EQ(recovered.get_ids().size(), (size_t)count) << "batched log lost documents";
+	ASSERT_LT(wal_time, 3 * memory_time);
+	std::filesystem::remove_all(dir);
+}
+
+// a document shaped like gen_data output, pretty printed with spaces after separators as hand written files are
+std::string gen_data_document(int depth)
+{
+	std::uniform_int_distribution<int> kind(0, depth > 0 ? 6 : 4);
+	std::uniform_int_distribution<int> length(5, 12);
+	std::uniform_int_distribution<int> fields(5, 15);
+	std::uniform_int_distribution<int> character(0, 35);
+	auto rand_string = [&]()
+	{
+		std::string s(length(mt) + 2, '"');
+		for (size_t i = 1; i + 1 < s.size(); i++)
+		{
+			int n = character(mt);
+			s[i] = n < 10 ? '0' + n : 'a' + n - 10;
+		}
+		return s;
+	};
+	auto value = [&]() -> std::string
+	{
+		switch (kind(mt))
+		{
+		case 0: return rand_string();
+		case 1: return std::to_string(static_cast<int>(mt() % 4000000) - 2000000);
+		case 2: return "1.234567e+" + std::to_string(mt() % 300);
+		case 3: return mt() % 2 ? "true" : "false";
+		case 4: return "null";
+		case 5: return gen_data_document(depth - 1);
+		default:
+			std::string array = "[";
+			for (int i = fields(mt); i > 0; i--)
+				array += (array.size() > 1 ? ", " : "") + rand_string();
+			return array + "]";
+		}
+	};
+	std::string object = "{";
+	for (int i = fields(mt); i > 0; i--)
+		object += (object.size() > 1 ? ", " : "") + rand_string() + ": " + value();
+	return object + "}";
+}
+
+TEST(RuntimeTest, structural_scanThroughput)
+{
+	std::vector<std::string> corpus;
+	size_t bytes = 0;
+	for (const auto &entry : std::filesystem::directory_iterator("datasets"))
+	{
+		if (entry.path().extension() != ".json")
+			continue;
+		std::ifstream file(entry.path());
+		std::stringstream ss;
+		ss << file.rdbuf();
+		if (ss.str().size() > 0)
+			corpus.push_back(ss.str());
+	}
+	while (bytes < 16 << 20)
+	{
+		corpus.push_back(gen_data_document(3));
+		bytes += corpus.back().size();
+	}
+	std::vector<std::string> minified;
+	for (const auto &doc : corpus)
+		minified.push_back(de_whitespace_json(doc));
+
+	auto measure = [&](scan_kernel kernel, std::vector<std::string> &out)
+	{
+		use_scan_kernel(kernel);
+		out.clear();
+		size_t checksum = 0;
+		auto t1 = hr_clock::now();
+		for (const auto &doc : corpus)
+			out.push_back(de_whitespace_json(doc));
+		for (const auto &doc : minified)
+			checksum += match_bracket(doc, 0);
+		double seconds = duration<double>(hr_clock::now() - t1).count();
+		EXPECT_GT(checksum, 0);
+		return seconds;
+	};
+
+	std::vector<std::string> expected, result;
+	double scalar_time = measure(scan_kernel::scalar, expected);
+	double scanned = 2.0 * bytes / (1 << 20);
+	std::cout << "scalar: " << scanned / scalar_time << " MB/s\n";
+	for (scan_kernel kernel : {scan_kernel::sse2, scan_kernel::avx2})
+	{
+		if (!scan_kernel_supported(kernel))
+			continue;
+		double time = measure(kernel, result);
+		std::cout << (kernel == scan_kernel::sse2 ? "sse2: " : "avx2: ") << scanned / time << " MB/s\n";
+		ASSERT_EQ(result, expected) << "vectorized kernel changed the output";
+	}
+	use_scan_kernel(best_scan_kernel());
+	double best_time = measure(best_scan_kernel(), result);
+	ASSERT_LT(best_time, scalar_time);
+}
+
+TEST(RuntimeTest, minify_jsonThroughput)
+{
+	std::vector<std::string> corpus;
+	size_t bytes = 0;
+	while (bytes < 16 << 20)
+	{
+		corpus.push_back(gen_data_document(3));
+		bytes += corpus.back().size();
+	}
+
+	std::vector<std::string> expected(corpus.size()), result(corpus.size());
+	auto t1 = hr_clock::now();
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		expected[i] = de_whitespace_json(corpus[i]);
+		ASSERT_FALSE(verify_json(expected[i]));
+	}
+	double two_pass_time = duration<double>(hr_clock::now() - t1).count();
+
+	auto t2 = hr_clock::now();
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		ASSERT_FALSE(minify_json(corpus[i], result[i]));
+	}
+	double one_pass_time = duration<double>(hr_clock::now() - t2).count();
+
+	double megabytes = 1.0 * bytes / (1 << 20);
+	std::cout << "de_whitespace_json + verify_json: " << megabytes / two_pass_time << " MB/s, minify_json: " << megabytes / one_pass_time << " MB/s\n";
+	ASSERT_EQ(result, expected) << "minify_json changed the output";
+	ASSERT_LT(one_pass_time, two_pass_time);
+}
+
+TEST(RuntimeTest, get_documentsProjection)
+{
+	Database db("test/temps");
+	db.add_collection("Projection");
+	db.set_current_collection("Projection");
+	for (int i = 0; i < 20000; i++)
+	{
+		db.add_document(gen_data_document(2).insert(1, "\"n\":" + std::to_string(i) + ",\"name\":\"Document " + std::to_string(i) + "\","));
+	}
+	std::string pattern = R"("n">=0)";
+
+	auto t1 = hr_clock::now();
+	double copy_sum = 0;
+	for (const Document &d : db.get_documents(pattern))
+	{
+		copy_sum += d.get<int>("n") + d.get<std::string>("name").size();
+	}
+	double copy_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+
+	auto t2 = hr_clock::now();
+	double projected_sum = 0;
+	for (const projected_row &row : db.get_documents(pattern, Projection({R"("n")", R"("name")"})))
+	{
+		projected_sum += row.get<int>(0) + row.get<std::string>(1).size();
+	}
+	double projected_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+
+	std::cout << "copies and query: " << copy_time << " ms, projection: " << projected_time << " ms\n";
+	ASSERT_EQ(projected_sum, copy_sum);
+	ASSERT_LT(projected_time, copy_time);
+}
+
+TEST(RuntimeTest, aggregateWithoutCopies)
+{
+	Database db("test/temps");
+	db.add_collection("Aggregate");
+	db.set_current_collection("Aggregate");
+	for (int i = 0; i < 20000; i++)
+	{
+		db.add_document(gen_data_document(2).insert(1, "\"n\":" + std::to_string(i) + ",\"group\":" + std::to_string(i % 8) + ","));
+	}
+	std::string pattern = R"("n">=100)";
+
+	auto t1 = hr_clock::now();
+	std::map<int, double> copy_sums;
+	for (const Document &d : db.get_documents(pattern))
+	{
+		copy_sums[d.get<int>("group")] += d.get<double>("n");
+	}
+	double copy_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+
+	auto t2 = hr_clock::now();
+	aggregate_groups groups = db.aggregate_by(pattern, R"("n")", R"("group")");
+	double aggregate_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+
+	std::cout << "copies and query: " << copy_time << " ms, aggregate_by: " << aggregate_time << " ms\n";
+	ASSERT_EQ(groups.size(), copy_sums.size());
+	for (const auto &[key, r] : groups)
+	{
+		EXPECT_DOUBLE_EQ(r.sum, copy_sums[(int)key.num]);
+	}
+	ASSERT_LT(aggregate_time, copy_time);
+}
+
+TEST(RuntimeTest, add_documentsBatch)
+{
+	std::vector<std::string> jsons;
+	for (int i = 0; i < 2000; i++)
+	{
+		jsons.push_back(gen_data_document(2));
+	}
+	std::vector<std::string> batch = jsons;
+
+	// with a synced log, single adds pay a commit each while a batch is one record and one commit
+	std::string dir = "test/temps/batch_wal";
+	std::filesystem::remove_all(dir);
+	std::filesystem::create_directories(dir);
+	{
+		Database db(dir, write_ahead_log::sync_policy::every_commit);
+		db.add_collection("Single");
+		db.add_collection("Batch");
+		db.set_current_collection("Single");
+		auto t1 = hr_clock::now();
+		for (const std::string &json : jsons)
+		{
+			db.add_document(json);
+		}
+		double single_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+
+		db.set_current_collection("Batch");
+		auto t2 = hr_clock::now();
+		auto [first, last] = db.add_documents(std::move(batch));
+		double batch_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+
+		std::cout << "add_document loop: " << single_time << " ms, add_documents: " << batch_time << " ms\n";
+		EXPECT_EQ(last - first, jsons.size());
+		EXPECT_LT(batch_time, single_time);
+	}
+	std::filesystem::remove_all(dir);
+}
+
+TEST(RuntimeTest, update_documentLargeDocument)
+{
+	std::string large = "{\"counter\":0";
+	while (large.size() < 50000)
+	{
+		large += ",\"f" + std::to_string(large.size()) + "\":" + gen_data_document(1);
+	}
+	large += "}";
+
+	Database db("test/temps");
+	db.add_collection("Large");
+	db.set_current_collection("Large");
+	size_t id = db.add_document(large);
+
+	// minifying the document is a lower bound for re-tokenizing and re-serializing all of it
+	auto t1 = hr_clock::now();
+	std::string minified;
+	for (int i = 0; i < 100; i++)
+	{
+		minify_json(large, minified);
+	}
+	double minify_time = duration<double, std::milli>(hr_clock::now() - t1).count();
+
+	auto t2 = hr_clock::now();
+	for (int i = 0; i < 100; i++)
+	{
+		db.update_document(id, "{\"counter\":" + std::to_string(i % 10) + "}");
+	}
+	double patch_time = duration<double, std::milli>(hr_clock::now() - t2).count();
+
+	std::cout << "minify whole document: " << minify_time << " ms, patch one field: " << patch_time << " ms\n";
+	EXPECT_EQ(db.get_document(id).get<int>("counter"), 9);
+	ASSERT_LT(patch_time, minify_time);
+}
@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <regex>
+#include "database.h"
+
+using hr_clock = std::chrono::high_resolution_clock;
+using std::chrono::duration;
+
+TEST(PathLexer, SplitsKeysAndIndices)
+{
+    path_lexer lexer(R"("Root"."sub \"quoted\""[12][0]."key")");
+    path_token token;
+
+    ASSERT_TRUE(lexer.next(token));
+    EXPECT_FALSE(token.is_index);
+    EXPECT_EQ(token.key, "Root") << "Failed to read first key";
+    ASSERT_TRUE(lexer.next(token));
+    EXPECT_EQ(token.key, R"(sub \"quoted\")") << "Failed to read key with escaped quotes";
+    ASSERT_TRUE(lexer.next(token));
+    EXPECT_TRUE(token.is_index);
+    EXPECT_EQ(token.index, 12) << "Failed to read index";
+    ASSERT_TRUE(lexer.next(token));
+    EXPECT_EQ(token.index, 0) << "Failed to read consecutive index";
+    ASSERT_TRUE(lexer.next(token));
+    EXPECT_EQ(token.key, "key") << "Failed to read last key";
+    EXPECT_FALSE(lexer.next(token)) << "Read past the end of the path";
+}
+
+TEST(PathLexer, RejectsBadSyntax)
+{
+    path_token token;
+    path_lexer unterminated(R"("key)");
+    path_lexer bad_index(R"("key"[x])");
+    path_lexer bare_key(R"(key)");
+    EXPECT_ANY_THROW(unterminated.next(token)) << "Unterminated key didn't throw";
+    ASSERT_TRUE(bad_index.next(token));
+    EXPECT_ANY_THROW(bad_index.next(token)) << "Non-numeric index didn't throw";
+    EXPECT_ANY_THROW(bare_key.next(token)) << "Unquoted key didn't throw";
+}
+
+TEST(PathLexer, GetFirstFieldCompatible)
+{
+    auto [key, remain] = get_first_field(R"("a"."b"[2])");
+    EXPECT_EQ(key, "\"a\"");
+    EXPECT_EQ(remain, R"("b"[2])");
+    std::tie(key, remain) = get_first_field(R"([2]."c")");
+    EXPECT_EQ(key, "[2]");
+    EXPECT_EQ(remain, R"("c")");
+}
+
+TEST(PathLexer, QueryDepths)
+{
+    Document d(R"({"a":{"b":[1,{"c":[true,"s"]}]},"top":3.5})");
+    EXPECT_EQ(d.query<double>(R"("top")"), 3.5) << "Single key query failed";
+    EXPECT_EQ(d.query<int>(R"("a"."b"[0])"), 1) << "Two level query failed";
+    EXPECT_EQ(d.query<bool>(R"("a"."b"[1]."c"[0])"), true) << "Four level query failed";
+    EXPECT_EQ(d.query<std::string>(R"("a"."b"[1]."c"[1])"), "\"s\"") << "Array in array query failed";
+    EXPECT_THROW(d.query<int>(R"("a"[0])"), std::runtime_error) << "Index into object didn't throw";
+    EXPECT_THROW(d.query<int>(R"("a"."b"[5])"), std::runtime_error) << "Out of bounds query didn't throw";
+}
+
+// the regex splitter get_first_field used before the lexer, kept as the benchmark baseline
+static std::pair<std::string, std::string> regex_first_field(std::string query)
+{
+    std::regex regex{R"(((".+?")|(\[[0-9]+?\])))"};
+    std::smatch match;
+    std::regex_search(query, match, regex);
+    if (match.suffix().str() != "" && match.suffix().str()[0] == '.')
+    {
+        return {match.str(1), match.suffix().str().substr(1)};
+    }
+    return {match.str(1), match.suffix().str()};
+}
+
+TEST(RuntimeTest, PathLexerAcrossDepths)
+{
+    const size_t iterations = 200;
+    for (size_t depth = 1; depth <= 8; depth *= 2)
+    {
+        std::string path = "\"field 0\"";
+        for (size_t i = 1; i < depth; i++)
+        {
+            path += (i % 2) ? "[" + std::to_string(i) + "]" : ".\"field " + std::to_string(i) + "\"";
+        }
+
+        size_t regex_segments = 0;
+        auto t1 = hr_clock::now();
+        for (size_t n = 0; n < iterations; n++)
+        {
+            std::string remain = path;
+            while (!remain.empty())
+            {
+                remain = regex_first_field(remain).second;
+                regex_segments++;
+            }
+        }
+        auto t2 = hr_clock::now();
+        size_t lexer_segments = 0;
+        for (size_t n = 0; n < iterations; n++)
+        {
+            path_lexer lexer(path);
+            path_token token;
+            while (lexer.next(token))
+                lexer_segments++;
+        }
+        auto t3 = hr_clock::now();
+
+        double regex_time = duration<double, std::micro>(t2 - t1).count();
+        double lexer_time = duration<double, std::micro>(t3 - t2).count();
+        std::cout << "depth " << depth << ": regex " << regex_time / iterations << " us/path, lexer "
+                  << lexer_time / iterations << " us/path (" << regex_time / lexer_time << "x)\n";
+
+        EXPECT_EQ(regex_segments, lexer_segments) << "Lexer and regex split paths differently";
+        EXPECT_LT(lexer_time, regex_time) << "Lexer was slower than regex at depth " << depth;
+    }
+}
@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+TEST(ResidentCollections, BudgetKeepsCollectionsInRam)
+{
+    Database db("test/temps");
+    db.set_memory_budget(1 << 20);
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.set_current_collection("foo");
+    size_t foo_id = db.add_document(R"({"name":"foo"})");
+    db.set_current_collection("bar");
+    db.add_document(R"({"name":"bar"})");
+
+    for (int i = 0; i < 10; i++)
+    {
+        db.set_current_collection(i % 2 == 0 ? "foo" : "bar");
+    }
+    EXPECT_FALSE(std::filesystem::exists("test/temps/foo.bin.tmp")) << "Collection within budget was cached";
+    EXPECT_EQ(db.get_resident_collection_names().size(), 2) << "Collection within budget isn't resident";
+
+    db.set_memory_budget(0);
+    EXPECT_TRUE(std::filesystem::exists("test/temps/foo.bin.tmp")) << "Zero budget didn't cache the inactive collection";
+    EXPECT_EQ(db.get_resident_collection_names(), std::vector<std::string>({"bar"})) << "Current collection was evicted";
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_document(foo_id).get<std::string>("name"), "\"foo\"") << "Evicted collection didn't reload";
+}
+
+TEST(ResidentCollections, EvictsLeastRecentlyUsed)
+{
+    Database db("test/temps");
+    std::string padding(1000, 'x');
+    for (const std::string name : {"a", "b", "c", "d"})
+    {
+        db.add_collection(name);
+        db.set_current_collection(name);
+        for (int i = 0; i < 100; i++)
+        {
+            db.add_document("{\"pad\":\"" + padding + "\"}");
+        }
+    }
+
+    // set_current_collection with the default budget left only d resident
+    db.set_memory_budget(150000); // room for about one other collection
+    db.set_current_collection("a");
+    db.set_current_collection("b");
+    db.set_current_collection("c");
+    auto resident = db.get_resident_collection_names();
+    std::sort(resident.begin(), resident.end());
+    EXPECT_EQ(resident, std::vector<std::string>({"b", "c"})) << "Wrong collections kept under the budget";
+}
+
+TEST(ResidentCollections, HandlesLeaveCurrentCollection)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.set_current_collection("foo");
+    db.add_document(R"({"name":"foo"})");
+
+    auto bar = db.get_collection("bar");
+    size_t id = bar.add_document(R"({"name":"bar","n":1})");
+    bar.add_document(R"({"name":"bar","n":2})");
+    bar.update_document(id, R"({"n":3})");
+    EXPECT_EQ(bar.get_document(id).get<int>("n"), 3) << "Handle update failed";
+    EXPECT_EQ(bar.get_documents(R"("name"="bar")").size(), 2) << "Handle filter failed";
+    bar.remove_documents(R"("n"=2)");
+    EXPECT_EQ(bar.get_ids(), std::vector<size_t>({id})) << "Handle removal failed";
+
+    EXPECT_EQ(db.get_ids().size(), 1) << "Handle changed the current collection";
+    EXPECT_EQ(db.get_documents(R"("name"="foo")").size(), 1) << "Handle changed the current collection";
+    EXPECT_ANY_THROW(db.get_collection("baz")) << "Handle to a missing collection";
+
+    db.set_current_collection("bar"); // bar was evicted by the zero budget, then reloads
+    EXPECT_EQ(db.get_document(id).get<int>("n"), 3) << "Handle changes were lost";
+}
+
+TEST(ResidentCollections, RenameKeepsCachedDocuments)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.set_current_collection("foo");
+    size_t id = db.add_document(R"({"name":"foo"})");
+    db.set_current_collection("bar"); // caches foo under its name
+    db.change_collection_name("foo", "renamed");
+    EXPECT_FALSE(std::filesystem::exists("test/temps/foo.bin.tmp")) << "Cache left under the old name";
+    db.set_current_collection("renamed");
+    EXPECT_EQ(db.get_document(id).get<std::string>("name"), "\"foo\"") << "Renamed collection lost its cached documents";
+}
+
+TEST(ResidentCollections, RemoveCollection)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.add_collection("baz");
+    db.set_current_collection("foo");
+    db.add_document(R"({"name":"foo"})");
+    db.set_current_collection("baz"); // caches foo
+    size_t id = db.add_document(R"({"name":"baz"})");
+
+    db.remove_collection("foo");
+    EXPECT_FALSE(std::filesystem::exists("test/temps/foo.bin.tmp")) << "Removed collection's cache left behind";
+    EXPECT_EQ(db.get_collection_names(), std::vector<std::string>({"bar", "baz"}));
+    EXPECT_EQ(db.get_document(id).get<std::string>("name"), "\"baz\"") << "Current collection lost when an earlier one was removed";
+
+    db.remove_collection("baz");
+    EXPECT_ANY_THROW(db.get_ids()) << "Removed current collection still current";
+    EXPECT_ANY_THROW(db.remove_collection("baz")) << "Removing a missing collection didn't throw";
+    db.set_current_collection("bar");
+    EXPECT_EQ(db.get_ids().size(), 0);
+}
+
+TEST(ResidentCollections, FailedLoadKeepsCurrentCollection)
+{
+    Database db("test/temps");
+    {
+        std::ofstream file("test/temps/unterminated.json");
+        file << R"([{"name":"bad")";
+    }
+    db.add_collection("foo");
+    db.add_collection_from_file("bad", "test/temps/unterminated.json");
+    db.set_current_collection("foo");
+    size_t id = db.add_document(R"({"name":"foo"})");
+
+    EXPECT_ANY_THROW(db.set_current_collection("bad")) << "Loaded an unterminated file";
+    std::filesystem::remove("test/temps/unterminated.json");
+    EXPECT_EQ(db.get_resident_collection_names(), std::vector<std::string>({"foo"})) << "Failed load changed what's resident";
+    EXPECT_EQ(db.get_ids(), std::vector<size_t>({id})) << "Failed load switched the current collection";
+}
@@ -0,0 +1,129 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+// an empty directory for a test's segments, removed afterwards
+struct segment_dir
+{
+    std::string path;
+
+    explicit segment_dir(const std::string &name) : path("test/temps/" + name)
+    {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+
+    ~segment_dir()
+    {
+        std::filesystem::remove_all(path);
+    }
+
+    size_t count() const
+    {
+        return std::distance(std::filesystem::directory_iterator(path), std::filesystem::directory_iterator());
+    }
+};
+
+TEST(Checkpoint, WritesOnlyChanges)
+{
+    segment_dir temp("checkpoint_changes");
+    Collection c("foo");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 1000; i++)
+    {
+        ids.push_back(c.add_document("{\"n\":" + std::to_string(i) + "}"));
+    }
+    c.checkpoint(temp.path);
+    size_t base_size = std::filesystem::file_size(temp.path + "/foo.0.seg");
+
+    c.update_document(ids[0], R"({"n":-1})");
+    c.remove_document(ids[1]);
+    c.checkpoint(temp.path);
+    ASSERT_TRUE(std::filesystem::exists(temp.path + "/foo.1.seg")) << "Delta segment not written";
+    EXPECT_LT(std::filesystem::file_size(temp.path + "/foo.1.seg") * 50, base_size) << "Delta segment holds unchanged documents";
+
+    c.checkpoint(temp.path);
+    EXPECT_EQ(temp.count(), 2) << "Segment written with nothing changed";
+}
+
+TEST(Checkpoint, LoadsLatestState)
+{
+    segment_dir temp("checkpoint_load");
+    Collection c("foo");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 10; i++)
+    {
+        ids.push_back(c.add_document("{\"n\":" + std::to_string(i) + "}"));
+    }
+    c.checkpoint(temp.path);
+    c.update_document(ids[0], R"({"n":100})");
+    c.remove_document(ids[1]);
+    c.checkpoint(temp.path);
+    size_t added = c.add_document(R"({"n":10})");
+    c.remove_document(ids[2]);
+    c.update_document(ids[3], R"({"seen":true})");
+    c.checkpoint(temp.path);
+
+    Collection loaded("foo");
+    loaded.add_document(R"({"stale":true})");
+    loaded.load_checkpoint(temp.path);
+    EXPECT_EQ(loaded.size(), 9) << "Wrong number of documents after load";
+    EXPECT_EQ(loaded.get_document(ids[0]).get<int>("n"), 100) << "Update not loaded";
+    EXPECT_ANY_THROW(loaded.get_document(ids[1])) << "Removal not loaded";
+    EXPECT_ANY_THROW(loaded.get_document(ids[2])) << "Later removal not loaded";
+    EXPECT_EQ(loaded.get_document(ids[3]).get<bool>("seen"), true) << "Later update not loaded";
+    EXPECT_EQ(loaded.get_document(added).get<int>("n"), 10) << "Added document not loaded";
+    EXPECT_EQ(loaded.get_documents(Filter(R"("stale"=true)"), false).size(), 0) << "Documents from before the load kept";
+
+    EXPECT_ANY_THROW(Collection("bar").load_checkpoint(temp.path)) << "Loaded without segments";
+}
+
+TEST(Checkpoint, MergeKeepsState)
+{
+    segment_dir temp("checkpoint_merge");
+    Collection c("foo");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 10; i++)
+    {
+        ids.push_back(c.add_document("{\"n\":" + std::to_string(i) + "}"));
+        c.checkpoint(temp.path);
+    }
+    c.remove_document(ids[5]);
+    c.checkpoint(temp.path);
+    Collection other("bar");
+    other.add_document(R"({"n":0})");
+    other.checkpoint(temp.path);
+
+    c.merge_checkpoints(temp.path);
+    EXPECT_EQ(temp.count(), 2) << "Segments not merged";
+    EXPECT_TRUE(std::filesystem::exists(temp.path + "/foo.11.seg")) << "Merged segment misnamed";
+    EXPECT_TRUE(std::filesystem::exists(temp.path + "/bar.0.seg")) << "Other collection's segment merged";
+
+    Collection loaded("foo");
+    loaded.load_checkpoint(temp.path);
+    EXPECT_EQ(loaded.size(), 9) << "Wrong number of documents after merge";
+    EXPECT_ANY_THROW(loaded.get_document(ids[5])) << "Removed document back after merge";
+    EXPECT_EQ(loaded.get_document(ids[9]).get<int>("n"), 9) << "Document lost in merge";
+
+    // checkpoints continue after the merged segment
+    c.update_document(ids[0], R"({"n":-1})");
+    c.checkpoint(temp.path);
+    loaded.load_checkpoint(temp.path);
+    EXPECT_EQ(loaded.get_document(ids[0]).get<int>("n"), -1) << "Checkpoint after merge not loaded";
+}
+
+TEST(Checkpoint, DatabaseRoundTrip)
+{
+    segment_dir temp("checkpoint_database");
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    size_t id = db.add_document(R"({"n":1})");
+    db.checkpoint_current_collection(temp.path);
+    db.update_document(id, R"({"n":2})");
+    db.checkpoint_current_collection(temp.path);
+    db.merge_current_collection_checkpoints(temp.path);
+
+    db.remove_document(id);
+    db.load_current_collection_checkpoint(temp.path);
+    EXPECT_EQ(db.get_document(id).get<int>("n"), 2) << "Checkpoint not restored";
+}
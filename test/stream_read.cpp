@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include "database.h"
+
+TEST(StreamRead, SplitsAcrossBlocks)
+{
+    std::string data = R"({"a":"}{[\"",
+        "b":[1,{"c":2}]}   {"d":{}}
+        {"e":"\\"})";
+    std::vector<std::string> out;
+    document_splitter splitter;
+    for (char c : data)
+    {
+        splitter.feed(std::string_view(&c, 1), out);
+    }
+    ASSERT_EQ(out.size(), 3) << "Wrong number of documents from single character blocks";
+    EXPECT_EQ(out[0], "{\"a\":\"}{[\\\"\",\n        \"b\":[1,{\"c\":2}]}") << "Braces inside a string ended the document";
+    EXPECT_EQ(out[1], "{\"d\":{}}") << "Nested empty object ended the document early";
+    EXPECT_EQ(out[2], "{\"e\":\"\\\\\"}") << "Escaped backslash before a quote wasn't handled";
+    EXPECT_FALSE(splitter.incomplete());
+
+    std::vector<std::string> array_out;
+    document_splitter array_splitter;
+    array_splitter.feed("  [\n\t{\"x\":[1,2]},\n\t{\"y", array_out);
+    EXPECT_EQ(array_out.size(), 1);
+    EXPECT_TRUE(array_splitter.incomplete()) << "Split document not reported as incomplete";
+    array_splitter.feed("\":3}\n]", array_out);
+    ASSERT_EQ(array_out.size(), 2) << "Wrong number of documents from array";
+    EXPECT_EQ(array_out[1], "{\"y\":3}") << "Document split between blocks wasn't joined";
+    EXPECT_FALSE(array_splitter.incomplete());
+}
+
+TEST(StreamRead, SplitsLongRunsWithEveryKernel)
+{
+    // strings and gaps longer than a vector, with structural bytes on either side of the vector boundaries
+    std::string text(70, 'x');
+    std::string documents[] = {
+        "{\"a\":\"" + text + "}]{[\\\"" + text + "\",\"b\":[" + std::string(40, ' ') + "1,{\"c\":\"\\\\\"}]}",
+        "{\"d\":{\"e\":[[[]]],\"f\":\"" + text + "\"}}",
+    };
+    std::string buffer = documents[0] + std::string(50, ' ') + ",\n" + documents[1] + std::string(33, '\n');
+
+    for (scan_kernel kernel : {scan_kernel::scalar, scan_kernel::sse2, scan_kernel::avx2})
+    {
+        if (!scan_kernel_supported(kernel))
+            continue;
+        use_scan_kernel(kernel);
+
+        std::vector<std::string_view> out;
+        document_splitter splitter;
+        splitter.split(buffer, out);
+        ASSERT_EQ(out.size(), 2) << "Wrong number of documents";
+        EXPECT_EQ(out[0], documents[0]) << "Structural bytes in a long string ended the document";
+        EXPECT_EQ(out[1], documents[1]);
+        EXPECT_FALSE(splitter.incomplete());
+
+        std::vector<std::string> blocks_out;
+        document_splitter block_splitter;
+        for (size_t i = 0; i < buffer.size(); i += 37)
+        {
+            block_splitter.feed(std::string_view(buffer).substr(i, 37), blocks_out);
+        }
+        ASSERT_EQ(blocks_out.size(), 2) << "Wrong number of documents from blocks";
+        EXPECT_EQ(blocks_out[0], documents[0]) << "Escape split across blocks wasn't carried over";
+        EXPECT_EQ(blocks_out[1], documents[1]);
+    }
+    use_scan_kernel(best_scan_kernel());
+}
+
+TEST(StreamRead, RejectsValuesBetweenDocuments)
+{
+    auto split = [](const std::string &buffer)
+    {
+        std::vector<std::string_view> out;
+        document_splitter splitter;
+        splitter.split(buffer, out);
+        return out.size();
+    };
+
+    EXPECT_EQ(split("[\n\t{\"a\":1} ,\n{\"b\":2}\n]\n"), 2) << "Separators between documents rejected";
+    EXPECT_EQ(split("{\"a\":1}\n{\"b\":2}"), 2) << "Documents on separate lines rejected";
+    EXPECT_THROW(split(R"([1, {"a":1}])"), std::runtime_error) << "Number in the array dropped";
+    EXPECT_THROW(split(R"(["x{", {"a":1}])"), std::runtime_error) << "String in the array read as a document";
+    EXPECT_THROW(split(R"({"a":1} stray {"b":2})"), std::runtime_error) << "Text between documents skipped";
+    EXPECT_THROW(split(R"([{"a":1}] {"b":2})"), std::runtime_error) << "Document after the array read";
+    EXPECT_THROW(split(R"({"a":1}])"), std::runtime_error) << "Closing bracket without an array accepted";
+
+    std::vector<std::string> out;
+    document_splitter splitter;
+    splitter.feed(R"([{"a":1},)", out);
+    EXPECT_THROW(splitter.feed(R"( tru)", out), std::runtime_error) << "Value split across blocks skipped";
+}
+
+TEST(StreamRead, LargeFileInOrder)
+{
+    {
+        std::ofstream file("test/temps/stream_read.json");
+        file << "[\n";
+        for (int i = 0; i < 20000; i++)
+        {
+            file << "\t{ \"n\" : " << i << ", \"pad\" : \"" << std::string(100, 'x') << "\" }" << (i == 19999 ? "\n" : ",\n");
+        }
+        file << "]";
+    }
+
+    Database db("test/temps");
+    db.add_collection_from_file("foo", "test/temps/stream_read.json");
+    db.set_current_collection("foo");
+    std::filesystem::remove("test/temps/stream_read.json");
+
+    auto ids = db.get_ids();
+    ASSERT_EQ(ids.size(), 20000) << "Documents lost across blocks";
+    int expected = 0;
+    for (const Document &d : db)
+    {
+        EXPECT_EQ(d.get<int>("n"), expected++) << "Documents out of order";
+    }
+    EXPECT_EQ(db.get_document(ids[12345]).get<int>("n"), 12345) << "Lookup after streamed read failed";
+}
+
+TEST(StreamRead, InvalidDocumentLeavesCollection)
+{
+    {
+        std::ofstream file("test/temps/stream_read_bad.json");
+        file << "{\"a\":1}\n{\"b\":tru}\n";
+    }
+    Collection c("foo");
+    c.add_document(R"({"z":0})");
+    EXPECT_ANY_THROW(c.read("test/temps/stream_read_bad.json")) << "Invalid document didn't throw";
+    EXPECT_EQ(c.size(), 1) << "Failed read left documents behind";
+
+    {
+        std::ofstream file("test/temps/stream_read_bad.json");
+        file << "{\"a\":1}\n{\"b\":[1,2}\n";
+    }
+    EXPECT_ANY_THROW(c.read("test/temps/stream_read_bad.json")) << "Truncated document didn't throw";
+    EXPECT_EQ(c.size(), 1) << "Failed read left documents behind";
+    std::filesystem::remove("test/temps/stream_read_bad.json");
+}
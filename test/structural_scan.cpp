@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+// runs check once per kernel the cpu supports, restoring the default afterwards
+template <typename F>
+void for_each_kernel(F check)
+{
+    for (scan_kernel kernel : {scan_kernel::scalar, scan_kernel::sse2, scan_kernel::avx2})
+    {
+        if (!scan_kernel_supported(kernel))
+            continue;
+        use_scan_kernel(kernel);
+        check(static_cast<int>(kernel));
+    }
+    use_scan_kernel(best_scan_kernel());
+}
+
+TEST(StructuralScan, KernelsAgree)
+{
+    // strings and nesting long enough to cross 16 and 32 byte chunks, with escapes on the boundaries
+    std::vector<std::string> inputs = {
+        R"("short")",
+        "\"" + std::string(15, 'a') + "\\\"" + std::string(40, 'b') + "\"",
+        "\"" + std::string(30, 'a') + "\\\\\"",
+        "{\"key\" : [1, 2, {\"nested\" : \"" + std::string(70, 'x') + "}\"}],\n\t\"other\" : \"{[\"\r\n}",
+        "[" + std::string(100, ' ') + "[\"]\"," + std::string(33, '\n') + "]]",
+        "\"unterminated " + std::string(50, 'z'),
+        std::string("\"nul\0inside\"", 12),
+        "{\"a\":" + std::string(64, '{') + std::string(64, '}') + "}",
+    };
+
+    std::vector<size_t> quotes, brackets;
+    std::vector<std::string> minified;
+    std::vector<bool> is_minified;
+    use_scan_kernel(scan_kernel::scalar);
+    for (const auto &input : inputs)
+    {
+        quotes.push_back(match_quote(input, 0));
+        brackets.push_back(match_bracket(input, 0));
+        minified.push_back(de_whitespace_json(input));
+        is_minified.push_back(json_is_minified(input));
+    }
+
+    for_each_kernel([&](int kernel)
+    {
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            EXPECT_EQ(match_quote(inputs[i], 0), quotes[i]) << "kernel " << kernel << ", input " << i;
+            EXPECT_EQ(match_bracket(inputs[i], 0), brackets[i]) << "kernel " << kernel << ", input " << i;
+            EXPECT_EQ(de_whitespace_json(inputs[i]), minified[i]) << "kernel " << kernel << ", input " << i;
+            EXPECT_EQ(json_is_minified(inputs[i]), is_minified[i]) << "kernel " << kernel << ", input " << i;
+        }
+    });
+}
+
+TEST(StructuralScan, Results)
+{
+    std::string escaped = "\"" + std::string(40, 'a') + "\\\"b\" tail";
+    std::string nested = "{\"a\": [{}, \"}\", {\"b\": \"" + std::string(50, ']') + "\"}], \"c\": 1}";
+    std::string spaced = "{ \"a b\" :\t[ 1 ,\n 2 ],\r\n \"" + std::string(40, ' ') + "\" : null }";
+    std::string expected = "{\"a b\":[1,2],\"" + std::string(40, ' ') + "\":null}";
+
+    for_each_kernel([&](int kernel)
+    {
+        EXPECT_EQ(match_quote(escaped, 0), 44) << "kernel " << kernel;
+        EXPECT_EQ(match_quote(escaped, 1), std::string::npos) << "kernel " << kernel;
+        EXPECT_EQ(match_bracket(nested, 0), nested.size() - 1) << "kernel " << kernel;
+        EXPECT_EQ(match_bracket(nested, 6), nested.find("], ")) << "kernel " << kernel;
+        EXPECT_EQ(de_whitespace_json(spaced), expected) << "kernel " << kernel;
+        EXPECT_FALSE(json_is_minified(spaced)) << "kernel " << kernel;
+        EXPECT_TRUE(json_is_minified(expected)) << "kernel " << kernel;
+    });
+}
+
+TEST(StructuralScan, UnsupportedKernelThrows)
+{
+    for (scan_kernel kernel : {scan_kernel::sse2, scan_kernel::avx2})
+    {
+        if (!scan_kernel_supported(kernel))
+        {
+            EXPECT_ANY_THROW(use_scan_kernel(kernel));
+        }
+    }
+}
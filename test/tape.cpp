@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+TEST(DocumentTape, MatchesUnparsedLookups)
+{
+    std::string data = R"({"String":"foobar","Number":3.5,"Int":42,"Bool":true,"Null":null,"Array":["a",[1,2],{"k":"v"}],"Object":{"Inner":{"Deep":[false,true]}}})";
+    Document parsed(data);
+    Document plain(data);
+    parsed.build_tape();
+
+    ASSERT_TRUE(parsed.is_parsed()) << "Tape was not built";
+    EXPECT_FALSE(plain.is_parsed()) << "Document was parsed without asking";
+    EXPECT_EQ(parsed.get<std::string>("String"), plain.get<std::string>("String")) << "Parsed string lookup differs";
+    EXPECT_EQ(parsed.get<double>("Number"), plain.get<double>("Number")) << "Parsed double lookup differs";
+    EXPECT_EQ(parsed.get<int>("Int"), 42) << "Parsed int lookup differs";
+    EXPECT_EQ(parsed.get<bool>("Bool"), true) << "Parsed bool lookup differs";
+    EXPECT_TRUE(parsed.is_null("Null")) << "Parsed null lookup differs";
+    EXPECT_EQ(parsed.get<json_array>("Array").get<json_array>(1).get<int>(1), 2) << "Parsed nested array lookup differs";
+    EXPECT_EQ(parsed.get<json_array>("Array").get<json_object>(2).get<std::string>("k"), "\"v\"") << "Parsed object in array lookup differs";
+    EXPECT_EQ(parsed.get<json_object>("Object").get<json_object>("Inner").get<json_array>("Deep").get<bool>(1), true) << "Parsed nested object lookup differs";
+}
+
+TEST(DocumentTape, ErrorsMatchUnparsed)
+{
+    Document d(R"({"Array":[1,2,3],"String":"s"})");
+    d.build_tape();
+
+    EXPECT_THROW(d.get<int>("Missing"), std::runtime_error) << "Missing field didn't throw";
+    EXPECT_THROW(d.get<int>("String"), std::runtime_error) << "Wrong type didn't throw";
+    EXPECT_THROW(d.get<json_array>("Array").get<int>(3), std::runtime_error) << "Out of bounds index didn't throw";
+    EXPECT_THROW(d.get<json_object>("Array"), std::runtime_error) << "Array as object didn't throw";
+}
+
+TEST(DocumentTape, PreparsedCollectionFilters)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.set_preparsed(true);
+    size_t id = db.add_document(R"({"name":"first","tags":["a","b"]})");
+    db.add_document(R"({"name":"second","tags":["c"]})");
+
+    EXPECT_TRUE(db.get_document(id).is_parsed()) << "Added document was not parsed";
+    EXPECT_EQ(db.get_documents(R"("name"="first")").size(), 1) << "Filter on preparsed collection failed";
+
+    db.update_document(id, R"({"name":"renamed"})");
+    EXPECT_EQ(db.get_document(id).get<std::string>("name"), "\"renamed\"") << "Tape was not rebuilt after update";
+    EXPECT_EQ(db.get_documents(R"("name"="renamed")").size(), 1) << "Filter after update failed";
+}
+
+TEST(DocumentTape, WrappersViewUnparsedDocument)
+{
+    std::string data = R"({"Array":["a",[1,2],{"k":"v"}],"Object":{"Inner":{"Deep":[false,true]}}})";
+    Document d(data);
+
+    json_object inner = d.get<json_object>("Object").get<json_object>("Inner");
+    json_object copy = inner;
+    EXPECT_EQ(copy.get<json_array>("Deep").get<bool>(1), true) << "Copied view lookup failed";
+    EXPECT_EQ(d.get<json_array>("Array").get<json_object>(2).get<std::string>("k"), "\"v\"") << "Object in array lookup failed";
+    EXPECT_THROW(inner.get<json_array>("Missing"), std::runtime_error) << "Missing field in view didn't throw";
+
+    json_array owned;
+    {
+        std::string temporary = R"([1,{"x":[7]}])";
+        owned = json_array(temporary);
+    }
+    EXPECT_EQ(owned.get<json_object>(1).get<json_array>("x").get<int>(0), 7) << "Wrapper made from a string doesn't own it";
+}
+
+TEST(DocumentTape, WrappersFromTemporariesOwnTheirJson)
+{
+    auto make = []()
+    {
+        return Document(R"({"o":{"k":"v","a":[1,{"x":2}]}})");
+    };
+
+    json_object o = make().get<json_object>("o");
+    json_array a = make().query<json_array>(R"("o"."a")");
+    json_object nested = json_object(R"({"i":{"k":3}})").get<json_object>("i");
+    make(); // reuses the storage the temporaries had
+    EXPECT_EQ(o.get<std::string>("k"), "\"v\"") << "Object from a temporary document viewed into it";
+    EXPECT_EQ(a.get<json_object>(1).get<int>("x"), 2) << "Array from a temporary document viewed into it";
+    EXPECT_EQ(nested.get<int>("k"), 3) << "Object from a temporary wrapper viewed into it";
+}
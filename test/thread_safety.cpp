@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <atomic>
+#include "database.h"
+
+TEST(ThreadSafety, ReadersDuringIngest)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.create_index(R"("kind")");
+
+    std::atomic<bool> done = false;
+    std::atomic<int> bad_reads = 0;
+    std::thread writer([&]()
+    {
+        for (int i = 0; i < 2000; i++)
+        {
+            size_t id = db.add_document("{\"kind\":\"a\",\"n\":" + std::to_string(i) + "}");
+            if (i % 3 == 0)
+                db.update_document(id, R"({"kind":"b"})");
+            if (i % 5 == 0)
+                db.remove_document(id);
+        }
+        done = true;
+    });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; r++)
+    {
+        readers.emplace_back([&, r]()
+        {
+            while (!done)
+            {
+                for (const Document &d : db.get_documents(R"("kind"="a")", r % 2 == 0))
+                {
+                    if (d.get<std::string>("kind") != "\"a\"")
+                        bad_reads++;
+                }
+                auto lock = db.read_lock();
+                size_t last = 0;
+                for (const Document &d : db)
+                {
+                    if (d.get_id() < last)
+                        bad_reads++;
+                    last = d.get_id();
+                }
+            }
+        });
+    }
+
+    writer.join();
+    for (auto &t : readers)
+    {
+        t.join();
+    }
+    EXPECT_EQ(bad_reads, 0) << "Readers saw an inconsistent collection";
+    // i % 5 == 0 removed, the rest of i % 3 == 0 updated
+    EXPECT_EQ(db.get_ids().size(), 1600) << "Concurrent reads lost writes";
+    EXPECT_EQ(db.get_documents(R"("kind"="b")").size(), 533) << "Concurrent reads lost updates";
+}
+
+TEST(ThreadSafety, SwitchCollectionsWhileReading)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.add_collection("bar");
+    db.set_current_collection("bar");
+    db.add_document(R"({"name":"bar"})");
+    db.set_current_collection("foo");
+    db.add_document(R"({"name":"foo"})");
+
+    std::atomic<bool> done = false;
+    std::atomic<int> bad_reads = 0;
+    std::thread reader([&]()
+    {
+        while (!done)
+        {
+            auto lock = db.read_lock();
+            size_t count = 0;
+            for (const Document &d : db)
+            {
+                std::string name = d.get<std::string>("name");
+                if (name != "\"foo\"" && name != "\"bar\"")
+                    bad_reads++;
+                count++;
+            }
+            if (count != 1)
+                bad_reads++;
+        }
+    });
+
+    for (int i = 0; i < 200; i++)
+    {
+        db.set_current_collection(i % 2 == 0 ? "bar" : "foo");
+    }
+    done = true;
+    reader.join();
+    EXPECT_EQ(bad_reads, 0) << "Reader saw a collection while it was swapped";
+}
+
+TEST(ThreadSafety, GetDocumentUnderReadLock)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    size_t id = db.add_document(R"({"n":0})");
+
+    std::atomic<bool> done = false;
+    std::atomic<int> bad_reads = 0;
+    std::thread writer([&]()
+    {
+        for (int i = 1; i <= 500; i++)
+        {
+            db.update_document(id, "{\"n\":" + std::to_string(i) + "}");
+        }
+        done = true;
+    });
+
+    int last = 0;
+    while (!done)
+    {
+        auto lock = db.read_lock();
+        const Document &d = db.get_document(lock, id); // a writer waiting here mustn't block the lookup
+        int n = d.get<int>("n");
+        if (n < last || d.get<int>("n") != n)
+            bad_reads++;
+        last = n;
+    }
+    writer.join();
+    EXPECT_EQ(bad_reads, 0) << "Document changed while the read lock was held";
+    EXPECT_EQ(db.get_document(id).get<int>("n"), 500);
+
+    Database empty("test/temps");
+    EXPECT_ANY_THROW(empty.get_document(empty.read_lock(), 0)) << "Lookup without a current collection";
+}
+
+TEST(ThreadSafety, DocumentRefsUnderReadLock)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    for (int i = 0; i < 10; i++)
+    {
+        db.add_document(R"({"kind":"even","n":0})");
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<int> bad_reads = 0;
+    std::thread writer([&]()
+    {
+        for (int i = 0; i < 500; i++)
+        {
+            db.add_document(R"({"kind":"odd"})"); // grows the collection, moving its documents
+        }
+        done = true;
+    });
+
+    while (!done)
+    {
+        auto lock = db.read_lock();
+        auto refs = db.get_document_refs(lock, R"("kind"="even")");
+        std::this_thread::yield();
+        for (const Document *d : refs)
+        {
+            if (d->get<int>("n") != 0)
+                bad_reads++;
+        }
+        if (refs.size() != 10)
+            bad_reads++;
+    }
+    writer.join();
+    EXPECT_EQ(bad_reads, 0) << "Documents moved while the read lock was held";
+
+    Database empty("test/temps");
+    EXPECT_ANY_THROW(empty.get_document_refs(empty.read_lock(), R"("kind"="even")")) << "Filter without a current collection";
+}
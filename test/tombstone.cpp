@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include "database.h"
+
+TEST(Tombstone, RemovalKeepsOrderUntilCompaction)
+{
+    Collection c("foo");
+    c.set_compaction_threshold(1);
+    std::vector<size_t> ids;
+    for (int i = 0; i < 10; i++)
+    {
+        ids.push_back(c.add_document("{\"n\":" + std::to_string(i) + "}"));
+    }
+
+    c.remove_document(ids[3]);
+    c.remove_documents(R"("n"=7)", false);
+    EXPECT_EQ(c.size(), 8) << "Removed documents still counted";
+    EXPECT_EQ(c.get_tombstone_count(), 2) << "Removals weren't deferred";
+    EXPECT_ANY_THROW(c.get_document(ids[3])) << "Removed document still found";
+    EXPECT_ANY_THROW(c.update_document(ids[7], R"({"n":0})")) << "Removed document still updatable";
+    EXPECT_EQ(c.get_documents(R"("n"=3)", true).size(), 0) << "Filter matched a removed document";
+
+    std::vector<int> seen;
+    for (const Document &d : c)
+    {
+        seen.push_back(d.get<int>("n"));
+    }
+    EXPECT_EQ(seen, std::vector<int>({0, 1, 2, 4, 5, 6, 8, 9})) << "Iteration didn't skip removed documents in order";
+
+    c.compact();
+    EXPECT_EQ(c.get_tombstone_count(), 0) << "Compaction left tombstones";
+    EXPECT_EQ(c.get_document(ids[9]).get<int>("n"), 9) << "Lookup after compaction failed";
+    seen.clear();
+    for (const Document &d : c)
+    {
+        seen.push_back(d.get<int>("n"));
+    }
+    EXPECT_EQ(seen, std::vector<int>({0, 1, 2, 4, 5, 6, 8, 9})) << "Compaction changed document order";
+}
+
+TEST(Tombstone, ThresholdTriggersCompaction)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.set_compaction_threshold(0.5);
+    std::vector<size_t> ids;
+    for (int i = 0; i < 100; i++)
+    {
+        ids.push_back(db.add_document("{\"n\":" + std::to_string(i % 4) + "}"));
+    }
+
+    db.remove_documents(R"("n"=0)", true);
+    EXPECT_EQ(db.get_ids().size(), 75) << "Wrong number of documents after parallel removal";
+    db.remove_documents(R"("n"=1)", false);
+    EXPECT_EQ(db.get_ids().size(), 50) << "Wrong number of documents after compacting removal";
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        if (i % 4 < 2)
+            EXPECT_ANY_THROW(db.get_document(ids[i])) << "Removed document " << i << " still found";
+        else
+            EXPECT_EQ(db.get_document(ids[i]).get<int>("n"), (int)(i % 4)) << "Lookup of document " << i << " failed";
+    }
+    EXPECT_ANY_THROW(db.set_compaction_threshold(2)) << "Out of range threshold accepted";
+}
+
+TEST(Tombstone, SaveSkipsRemoved)
+{
+    Database db("test/temps");
+    db.add_collection("foo");
+    db.set_current_collection("foo");
+    db.set_compaction_threshold(1);
+    size_t a = db.add_document(R"({"n":1})");
+    db.add_document(R"({"n":2})");
+    db.remove_document(a);
+    db.save_current_collection("test/temps/tombstone_save.json");
+
+    std::ifstream file("test/temps/tombstone_save.json");
+    std::stringstream ss;
+    ss << file.rdbuf();
+    file.close();
+    std::filesystem::remove("test/temps/tombstone_save.json");
+    EXPECT_EQ(ss.str(), "[\n\t{\"n\":2}\n]") << "Saved file contains a removed document";
+}
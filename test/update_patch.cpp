@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include "database.h"
+
+// the json of the document with id, through to_string since the raw json is private
+static std::string formatted(Collection &c, size_t id)
+{
+    std::string s = c.get_document(id).to_string();
+    return s.substr(s.find(':'));
+}
+
+static std::string formatted(const std::string &json)
+{
+    std::string s = Document(json).to_string();
+    return s.substr(s.find(':'));
+}
+
+TEST(UpdatePatch, MatchesExpectedJson)
+{
+    const std::vector<std::array<std::string, 3>> cases = {
+        {R"({"a":1,"b":2})", R"({"a":5,"c":3})", R"({"a":5,"b":2,"c":3})"},
+        {R"({"a":{"x":1},"b":2})", R"({"a":{"y":2}})", R"({"a":{"x":1,"y":2},"b":2})"},
+        {R"({"a":1,"b":2})", R"({"a":{"x":7}})", R"({"a":{"x":7},"b":2})"},
+        {R"({"a":{"x":1}})", R"({"a":5})", R"({"a":5})"},
+        {R"({"a":1,"b":2})", R"({"a":[5,6]})", R"({"a":[5,6],"b":2})"},
+        {R"({"a":1,"b":2})", R"({"a":delete})", R"({"b":2})"},
+        {R"({"a":1,"b":2})", R"({"z":delete})", R"({"a":1,"b":2})"},
+        {R"({"a":1,"b":2,"c":3})", R"({"b":delete})", R"({"a":1,"c":3})"},
+        {R"({"a":1,"b":2,"c":3})", R"({"c":delete,"b":delete,"d":"x"})", R"({"a":1,"d":"x"})"},
+        {R"({"a":1})", R"({"z":1,"a":delete})", R"({"z":1})"},
+        {R"({})", R"({"b":1})", R"({"b":1})"},
+        {R"({"a":{}})", R"({"a":{"x":1}})", R"({"a":{"x":1}})"},
+        {R"({"a":{"b":{"c":1,"d":2}},"e":[1]})", R"({"a":{"b":{"c":delete,"f":true}},"e":[2,3]})", R"({"a":{"b":{"d":2,"f":true}},"e":[2,3]})"},
+        {R"({"a":1})", R"({"a":2,"a":3})", R"({"a":3})"},
+        {R"({"s":"a,b}","n":1})", R"({"n":2})", R"({"s":"a,b}","n":2})"},
+        {R"({"x":5})", R"({"obj":{"y":delete}})", R"({"x":5,"obj":{}})"},
+        {R"({"obj":5})", R"({"obj":{"y":delete,"z":1}})", R"({"obj":{"z":1}})"},
+        {R"({"a":1})", R"({"a":{"b":{"c":delete,"d":{"e":delete}},"f":delete}})", R"({"a":{"b":{"d":{}}}})"},
+    };
+
+    for (const auto &[json, patch, expected] : cases)
+    {
+        Collection c("foo");
+        size_t id = c.add_document(json);
+        c.update_document(id, patch);
+        EXPECT_EQ(formatted(c, id), formatted(expected)) << json << " patched with " << patch;
+    }
+}
+
+TEST(UpdatePatch, KeepsOtherDocumentsAndIndexes)
+{
+    Collection c("foo");
+    c.create_index(R"("state")");
+    std::vector<size_t> ids;
+    for (int i = 0; i < 100; i++)
+    {
+        ids.push_back(c.add_document("{\"n\":" + std::to_string(i) + ",\"state\":\"new\"}"));
+    }
+
+    // same length values are written over the stored json, others are moved
+    c.update_documents(R"("n"<50)", R"({"state":"old"})", true);
+    c.update_documents(R"("n">=90)", R"({"state":"finished","extra":[1,2]})", false);
+    EXPECT_EQ(c.get_documents(R"("state"="old")", false).size(), 50) << "Index missed an in place update";
+    EXPECT_EQ(c.get_documents(R"("state"="finished")", false).size(), 10) << "Index missed a moved update";
+    EXPECT_EQ(c.get_documents(R"("state"="new")", false).size(), 40) << "Untouched documents changed";
+    EXPECT_EQ(c.get_document(ids[95]).get<json_array>("extra").get<int>(1), 2) << "Appended field lost";
+    EXPECT_EQ(c.get_document(ids[49]).get<int>("n"), 49) << "Field next to the patch changed";
+}
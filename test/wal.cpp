@@ -0,0 +1,397 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include <thread>
+#include "database.h"
+
+using sync_policy = write_ahead_log::sync_policy;
+
+// an empty directory for a test's log, removed after the databases using it are gone
+struct wal_dir
+{
+    std::string path;
+
+    explicit wal_dir(const std::string &name) : path("test/temps/" + name)
+    {
+        std::filesystem::remove_all(path);
+        std::filesystem::create_directories(path);
+    }
+
+    ~wal_dir()
+    {
+        std::filesystem::remove_all(path);
+    }
+};
+
+TEST(WriteAheadLog, ReplaysMutations)
+{
+    wal_dir temp("wal_replay");
+    const std::string &dir = temp.path;
+    std::vector<size_t> ids;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection("foo");
+        db.add_collection("bar");
+        db.set_current_collection("foo");
+        for (int i = 0; i < 10; i++)
+        {
+            ids.push_back(db.add_document("{\"n\":" + std::to_string(i) + ",\"kind\":\"" + (i % 2 ? "odd" : "even") + "\"}"));
+        }
+        db.update_document(ids[0], R"({"n":100})");
+        db.remove_document(ids[1]);
+        db.update_documents(R"("kind"="odd")", R"({"seen":true})");
+        db.remove_documents(R"("n"=4)");
+        db.get_collection("bar").add_document(R"({"n":-1})");
+        db.change_collection_name("bar", "baz");
+    }
+
+    Database db(dir, sync_policy::every_commit);
+    EXPECT_EQ(db.get_collection_names(), std::vector<std::string>({"foo", "baz"})) << "Collections not replayed";
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 8) << "Wrong number of documents after replay";
+    EXPECT_EQ(db.get_document(ids[0]).get<int>("n"), 100) << "Update not replayed";
+    EXPECT_ANY_THROW(db.get_document(ids[1])) << "Removal not replayed";
+    EXPECT_ANY_THROW(db.get_document(ids[4])) << "Filtered removal not replayed";
+    EXPECT_EQ(db.get_documents(R"("seen"=true)").size(), 4) << "Filtered update not replayed";
+    EXPECT_EQ(db.get_collection("baz").get_ids().size(), 1) << "Handle add not replayed";
+
+    // new ids don't collide with replayed ones
+    size_t id = db.add_document(R"({"n":11})");
+    EXPECT_EQ(std::count(ids.begin(), ids.end(), id), 0) << "Replayed id handed out again";
+}
+
+TEST(WriteAheadLog, DropsTornRecord)
+{
+    wal_dir temp("wal_torn");
+    const std::string &dir = temp.path;
+    size_t id;
+    {
+        Database db(dir, sync_policy::batched);
+        db.add_collection("foo");
+        db.set_current_collection("foo");
+        id = db.add_document(R"({"n":1})");
+    }
+    size_t intact = std::filesystem::file_size(dir + "/database.wal");
+    {
+        std::ofstream file(dir + "/database.wal", std::ios::binary | std::ios::app);
+        const char torn[] = "\x40\x00\x00\x00\x01\x02\x03\x04partial"; // a record that never finished
+        file.write(torn, sizeof(torn) - 1);
+    }
+
+    {
+        Database db(dir, sync_policy::batched);
+        db.set_current_collection("foo");
+        EXPECT_EQ(db.get_document(id).get<int>("n"), 1) << "Intact record lost with the torn one";
+        EXPECT_EQ(std::filesystem::file_size(dir + "/database.wal"), intact) << "Torn record wasn't cut from the log";
+        db.add_document(R"({"n":2})");
+    }
+
+    Database db(dir, sync_policy::batched);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 2) << "Record after the cut wasn't replayed";
+}
+
+TEST(WriteAheadLog, ReportsRecordThatFailsToReplay)
+{
+    wal_dir temp("wal_bad_record");
+    const std::string &dir = temp.path;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection("foo");
+        db.set_current_collection("foo");
+        db.add_document(R"({"n":1})");
+    }
+    {
+        write_ahead_log log(dir + "/database.wal", sync_policy::every_commit);
+        log.commit(log.append(wal_record('u').add("foo").add(uint64_t(12345)).add(R"({"n":2})"))); // no such document
+        log.commit(log.append(wal_record('c').add("bar")));
+    }
+
+    try
+    {
+        Database db(dir, sync_policy::every_commit);
+        FAIL() << "Opened with a record that can't be replayed";
+    }
+    catch (const std::runtime_error &e)
+    {
+        EXPECT_NE(std::string(e.what()).find("record 2 ('u')"), std::string::npos) << "Error doesn't name the record: " << e.what();
+    }
+}
+
+TEST(WriteAheadLog, FileIdsSurviveReplay)
+{
+    wal_dir temp("wal_file");
+    const std::string &dir = temp.path;
+    std::vector<size_t> ids;
+    {
+        Database db(dir, sync_policy::none);
+        db.add_collection_from_file("foo", "test/saves/test2.json");
+        db.add_collection("bar");
+        db.set_current_collection("bar");
+        db.add_document(R"({"n":1})"); // moves the id counter past where foo will start
+        db.set_current_collection("foo");
+        ids = db.get_ids();
+        db.update_document(ids[1], R"({"field1":4321})");
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        Document d; // moves the id counter, as a fresh process would start elsewhere
+    }
+    Database db(dir, sync_policy::none);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids(), ids) << "File documents got different ids on replay";
+    EXPECT_EQ(db.get_document(ids[1]).get<int>("field1"), 4321) << "Update by id hit the wrong document";
+}
+
+TEST(WriteAheadLog, GroupCommitAcrossThreads)
+{
+    wal_dir temp("wal_group");
+    const std::string &dir = temp.path;
+    {
+        Database db(dir, sync_policy::every_commit);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++)
+        {
+            db.add_collection("c" + std::to_string(t));
+        }
+        db.set_memory_budget(1 << 24);
+        for (int t = 0; t < 4; t++)
+        {
+            writers.emplace_back([&db, t]()
+            {
+                auto c = db.get_collection("c" + std::to_string(t));
+                for (int i = 0; i < 50; i++)
+                {
+                    c.add_document("{\"n\":" + std::to_string(i) + "}");
+                }
+            });
+        }
+        for (auto &w : writers)
+        {
+            w.join();
+        }
+    }
+
+    Database db(dir, sync_policy::every_commit);
+    for (int t = 0; t < 4; t++)
+    {
+        EXPECT_EQ(db.get_collection("c" + std::to_string(t)).get_ids().size(), 50) << "Concurrent commits lost records";
+    }
+}
+
+TEST(WriteAheadLog, BatchedCommitsAcrossThreadsKeepOrder)
+{
+    wal_dir temp("wal_group_batched");
+    const std::string &dir = temp.path;
+    const std::string padding(500, 'x'); // fills batch_bytes often, so batches are written while others are committed
+    {
+        Database db(dir, sync_policy::batched);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 8; t++)
+        {
+            db.add_collection("c" + std::to_string(t));
+        }
+        db.set_memory_budget(1 << 26);
+        for (int t = 0; t < 8; t++)
+        {
+            writers.emplace_back([&db, &padding, t]()
+            {
+                auto c = db.get_collection("c" + std::to_string(t));
+                for (int i = 0; i < 2000; i++)
+                {
+                    size_t id = c.add_document("{\"n\":" + std::to_string(i) + ",\"p\":\"" + padding + "\"}");
+                    c.update_document(id, "{\"n\":" + std::to_string(-i) + "}"); // replays only after its add
+                }
+            });
+        }
+        for (auto &w : writers)
+        {
+            w.join();
+        }
+    }
+
+    Database db(dir, sync_policy::batched);
+    for (int t = 0; t < 8; t++)
+    {
+        auto c = db.get_collection("c" + std::to_string(t));
+        std::vector<size_t> ids = c.get_ids();
+        ASSERT_EQ(ids.size(), 2000) << "Concurrent batched commits lost records";
+        EXPECT_EQ(c.get_document(ids.back()).get<int>("n"), -1999) << "Batches written out of order";
+    }
+}
+
+TEST(WriteAheadLog, FileSavedOverItsSourceSurvivesReplay)
+{
+    wal_dir temp("wal_save_source");
+    const std::string &dir = temp.path;
+    const std::string source = dir + "/source.json";
+    std::filesystem::copy_file("test/saves/test2.json", source);
+    std::vector<size_t> ids;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection_from_file("foo", source);
+        db.set_current_collection("foo");
+        db.add_document(R"({"n":1})");
+        db.save_current_collection(source); // the replay must not read the saved document back from here
+        ids = db.get_ids();
+    }
+
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.set_current_collection("foo");
+        EXPECT_EQ(db.get_ids(), ids) << "Replay read the file as it was saved rather than as it was loaded";
+    }
+
+    std::filesystem::remove(source);
+    Database db(dir, sync_policy::every_commit);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids(), ids) << "Replay needed the source file";
+}
+
+TEST(WriteAheadLog, RotatesAfterCheckpoint)
+{
+    wal_dir temp("wal_rotate");
+    const std::string &dir = temp.path;
+    const std::string segments = dir + "/segments";
+    std::filesystem::create_directories(segments);
+    const std::string padding(40000, 'x'); // grows the log past write_ahead_log::rewrite_bytes
+    std::vector<size_t> ids;
+    uintmax_t grown;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection("foo");
+        db.add_collection("bar");
+        db.set_memory_budget(1); // bar is cached to the temp directory when foo is made current
+        db.set_current_collection("bar");
+        db.add_document(R"({"n":-1})");
+        db.set_current_collection("foo");
+        for (int i = 0; i < 10; i++)
+        {
+            ids.push_back(db.add_document("{\"n\":" + std::to_string(i) + "}"));
+        }
+        for (int i = 0; i < 200; i++)
+        {
+            db.update_document(ids[0], "{\"n\":" + std::to_string(i) + ",\"p\":\"" + padding + "\"}");
+        }
+        grown = std::filesystem::file_size(dir + "/database.wal");
+        db.checkpoint_current_collection(segments);
+        EXPECT_LT(std::filesystem::file_size(dir + "/database.wal"), grown / 4) << "Log not rotated after checkpoint";
+
+        for (int i = 0; i < 50; i++)
+        {
+            db.update_document(ids[3], "{\"n\":" + std::to_string(i) + ",\"p\":\"" + padding + "\"}");
+        }
+        grown = std::filesystem::file_size(dir + "/database.wal");
+        db.save_current_collection(dir + "/foo.json");
+        EXPECT_LT(std::filesystem::file_size(dir + "/database.wal"), grown / 4) << "Log not rotated after save";
+
+        // changed after the rotation, so the next checkpoint has to write them
+        db.update_document(ids[1], R"({"n":100})");
+        db.remove_document(ids[2]);
+    }
+
+    Database db(dir, sync_policy::every_commit);
+    EXPECT_EQ(db.get_collection("bar").get_ids().size(), 1) << "Cached collection lost by the rotation";
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 9) << "Rotated log replayed the wrong documents";
+    EXPECT_EQ(db.get_document(ids[0]).get<int>("n"), 199) << "Rotated log lost an update";
+    EXPECT_EQ(db.get_document(ids[3]).get<int>("n"), 49) << "Rotated log lost an update";
+    EXPECT_GT(db.add_document(R"({"n":11})"), ids.back()) << "Replayed id handed out again";
+
+    db.checkpoint_current_collection(segments);
+    db.load_current_collection_checkpoint(segments);
+    EXPECT_EQ(db.get_ids().size(), 10) << "Changes pending a checkpoint lost by the rotation";
+    EXPECT_EQ(db.get_document(ids[1]).get<int>("n"), 100) << "Update after the rotation not checkpointed";
+    EXPECT_EQ(db.get_document(ids[3]).get<int>("n"), 49) << "Update pending a checkpoint lost by the rotation";
+}
+
+TEST(WriteAheadLog, SmallCheckpointKeepsLog)
+{
+    wal_dir temp("wal_keep");
+    const std::string &dir = temp.path;
+    const std::string segments = dir + "/segments";
+    std::filesystem::create_directories(segments);
+    size_t id;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection("foo");
+        db.set_current_collection("foo");
+        for (int i = 0; i < 100; i++)
+        {
+            id = db.add_document("{\"n\":" + std::to_string(i) + "}");
+        }
+        db.checkpoint_current_collection(segments);
+        db.update_document(id, R"({"n":-1})");
+        uintmax_t before = std::filesystem::file_size(dir + "/database.wal");
+        db.checkpoint_current_collection(segments);
+        EXPECT_EQ(std::filesystem::file_size(dir + "/database.wal"), before) << "Small log rewritten by a checkpoint";
+    }
+
+    Database db(dir, sync_policy::every_commit);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 100) << "Log kept by the checkpoint replayed the wrong documents";
+    EXPECT_EQ(db.get_document(id).get<int>("n"), -1) << "Log kept by the checkpoint lost an update";
+}
+
+TEST(WriteAheadLog, FlushesWithinIntervalWithoutCommits)
+{
+    for (sync_policy policy : {sync_policy::batched, sync_policy::none})
+    {
+        wal_dir temp("wal_interval");
+        const std::string &dir = temp.path;
+        Database db(dir, policy);
+        db.add_collection("foo"); // the only commit, so it has to be written by the interval
+        std::this_thread::sleep_for(write_ahead_log::batch_interval * 5);
+        EXPECT_GT(std::filesystem::file_size(dir + "/database.wal"), 0) << "Record not written within the interval";
+    }
+}
+
+TEST(WriteAheadLog, LoadedCheckpointSurvivesLaterCheckpoints)
+{
+    wal_dir temp("wal_checkpoint");
+    const std::string &dir = temp.path;
+    const std::string segments = dir + "/segments";
+    std::filesystem::create_directories(segments);
+    size_t added;
+    {
+        Database db(dir, sync_policy::every_commit);
+        db.add_collection("foo");
+        db.set_current_collection("foo");
+        db.add_document(R"({"n":1})");
+        db.checkpoint_current_collection(segments);
+        db.load_current_collection_checkpoint(segments);
+        added = db.add_document(R"({"n":2})");
+        db.checkpoint_current_collection(segments); // the replay must not see this segment when loading the first
+    }
+
+    Database db(dir, sync_policy::every_commit);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 2) << "Loaded checkpoint replayed with later segments";
+    EXPECT_EQ(db.get_document(added).get<int>("n"), 2) << "Document added after the load not replayed";
+}
+
+TEST(WriteAheadLog, ReplaysBatchInserts)
+{
+    wal_dir temp("wal_batch");
+    const std::string &dir = temp.path;
+    std::pair<size_t, size_t> ids, buffer_ids;
+    {
+        Database db(dir, sync_policy::batched);
+        db.add_collection("foo");
+        db.set_current_collection("foo");
+        std::vector<std::string> jsons;
+        for (int i = 0; i < 100; i++)
+        {
+            jsons.push_back("{\"n\": " + std::to_string(i) + "}");
+        }
+        ids = db.add_documents(std::move(jsons));
+        buffer_ids = db.get_collection("foo").add_documents_from_buffer(R"([{"n":100},{"n":101}])");
+    }
+
+    Database db(dir, sync_policy::batched);
+    db.set_current_collection("foo");
+    EXPECT_EQ(db.get_ids().size(), 102) << "Batches not replayed";
+    EXPECT_EQ(db.get_document(ids.first + 42).get<int>("n"), 42) << "Batch replayed with different ids";
+    EXPECT_EQ(db.get_document(buffer_ids.second - 1).get<int>("n"), 101) << "Buffer batch replayed with different ids";
+    EXPECT_GE(db.add_document(R"({"n":102})"), buffer_ids.second) << "Replayed id handed out again";
+}